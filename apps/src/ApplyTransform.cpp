@@ -1,10 +1,16 @@
+#include <algorithm>
 #include <iostream>
+#include <set>
+#include <vector>
 
 #include <boost/program_options.hpp>
+#include <opencv2/core.hpp>
 
 #include "rt/ImageTransformResampler.hpp"
 #include "rt/filesystem.hpp"
+#include "rt/io/FileExtensionFilter.hpp"
 #include "rt/io/ImageIO.hpp"
+#include "rt/io/TIFFIO.hpp"
 #include "rt/types/Transforms.hpp"
 #include "rt/util/ImageConversion.hpp"
 
@@ -18,14 +24,29 @@ int main(int argc, char* argv[])
     po::options_description required("General Options");
     required.add_options()
             ("help,h", "Show this message")
-            ("moving,m", po::value<std::string>()->required(), "Moving image")
+            ("moving,m",
+                po::value<std::vector<std::string>>()->multitoken()->required(),
+                "Moving image. If more than one is provided, all are "
+                "resampled with the same transform and written to "
+                "--output-dir.")
             ("fixed,f", po::value<std::string>()->required(), "Fixed image")
             ("transform,t", po::value<std::string>()->required(),
                 "Input file path for the transform file")
-            ("output-file,o", po::value<std::string>()->required(),
+            ("output-file,o", po::value<std::string>(),
                 "Output file path for the registered moving image")
+            ("output-dir", po::value<std::string>(),
+                "Output directory for a batch of registered moving images. "
+                "Each output keeps the file name of its moving image.")
             ("enable-alpha", "If enabled, an alpha layer will be "
-                "added to the moving image if it does not already have one.");
+                "added to the moving image if it does not already have one.")
+            ("interpolation",
+                po::value<std::string>()->default_value("nearest"),
+                "Interpolation used to resample the moving image. Options: "
+                "nearest, linear, bspline, sinc")
+            ("approximate", po::value<double>()->default_value(0),
+                "If positive, approximate the transform from a coarse "
+                "lattice of exact evaluations with at most this much error "
+                "(in pixels). Useful for fast previews.");
 
     po::options_description all("Usage");
     all.add(required);
@@ -50,26 +71,141 @@ int main(int argc, char* argv[])
     }
 
     fs::path fixedPath = parsed["fixed"].as<std::string>();
-    fs::path movingPath = parsed["moving"].as<std::string>();
+    auto movingPaths = parsed["moving"].as<std::vector<std::string>>();
     fs::path tfmPath = parsed["transform"].as<std::string>();
-    fs::path outputPath = parsed["output-file"].as<std::string>();
+    auto batch = movingPaths.size() > 1 or parsed.count("output-dir") > 0;
+    if (batch and parsed.count("output-dir") == 0) {
+        std::cerr << "ERROR: --output-dir is required when transforming ";
+        std::cerr << "multiple images" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (not batch and parsed.count("output-file") == 0) {
+        std::cerr << "ERROR: --output-file is required" << std::endl;
+        return EXIT_FAILURE;
+    }
+    auto forceAlpha = parsed.count("enable-alpha") > 0;
+
+    rt::Interpolation interpolation;
+    try {
+        interpolation =
+            rt::ParseInterpolation(parsed["interpolation"].as<std::string>());
+    } catch (const std::invalid_argument& e) {
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
 
     // Read transform
     auto transform = rt::ReadTransform(tfmPath);
 
-    // Load the fixed image and moving image (at full depth)
+    // Load the fixed image
     auto fixed = rt::ReadImage(fixedPath);
-    auto moving = rt::ReadImage(movingPath);
 
-    // Add alpha channel if requested and needed
-    if (parsed.count("enable-alpha") > 0 and
-        (moving.channels() == 1 or moving.channels() == 3)) {
-        moving = rt::ColorConvertImage(moving, moving.channels() + 1);
+    // Load moving images at full depth
+    auto loadMoving = [forceAlpha](const fs::path& path) {
+        auto moving = rt::ReadImage(path);
+        // Add alpha channel if requested and needed
+        auto cns = moving.channels();
+        if (forceAlpha and (cns == 1 or cns == 3)) {
+            moving = rt::ColorConvertImage(moving, cns + 1);
+        }
+        return moving;
+    };
+
+    // Evaluate the transform at every output pixel
+    auto tolerance = parsed["approximate"].as<double>();
+    auto computeField = [&]() {
+        std::cout << "Computing deformation field..." << std::endl;
+        if (tolerance <= 0) {
+            return rt::ComputeDeformationField(transform, fixed.size());
+        }
+        rt::FieldApproximation info;
+        auto field = rt::ApproximateDeformationField(
+            transform, fixed.size(), tolerance, 16, &info);
+        std::cout << "Approximated transform with a lattice spacing of ";
+        std::cout << info.spacing << " px (max. error over " << info.samples;
+        std::cout << " samples: " << info.maxError << " px)" << std::endl;
+        return field;
+    };
+
+    ///// Batch mode /////
+    if (batch) {
+        fs::path outputDir = parsed["output-dir"].as<std::string>();
+
+        // Outputs are named after their inputs, so names must be unique
+        std::set<fs::path> names;
+        for (const auto& p : movingPaths) {
+            auto name = fs::path(p).filename();
+            if (not names.insert(name).second) {
+                std::cerr << "ERROR: More than one moving image is named ";
+                std::cerr << name << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        fs::create_directories(outputDir);
+
+        // Evaluate the transform once for every image
+        auto field = computeField();
+
+        // Load, resample, and write one group of images at a time so that
+        // the whole batch is never in memory
+        auto total = static_cast<int>(movingPaths.size());
+        auto groupSize = std::max(cv::getNumThreads(), 1);
+        for (int start = 0; start < total; start += groupSize) {
+            auto end = std::min(start + groupSize, total);
+            std::vector<cv::Mat> images(end - start);
+            cv::parallel_for_(cv::Range(start, end), [&](const cv::Range& r) {
+                for (auto i = r.start; i < r.end; i++) {
+                    images[i - start] = loadMoving(movingPaths[i]);
+                }
+            });
+
+            std::cout << "Transforming images " << start + 1 << "-" << end;
+            std::cout << " of " << total << "..." << std::endl;
+            auto results =
+                rt::ImageTransformResampler(images, field, interpolation);
+
+            cv::parallel_for_(cv::Range(start, end), [&](const cv::Range& r) {
+                for (auto i = r.start; i < r.end; i++) {
+                    auto name = fs::path(movingPaths[i]).filename();
+                    rt::WriteImage(outputDir / name, results[i - start]);
+                }
+            });
+        }
+        return EXIT_SUCCESS;
+    }
+
+    ///// Single image mode /////
+    fs::path outputPath = parsed["output-file"].as<std::string>();
+    auto moving = loadMoving(movingPaths.front());
+
+    // Replace the transform with a coarse lattice. Only the lattice is held
+    // in memory, so TIFF outputs are still streamed.
+    if (tolerance > 0) {
+        std::cout << "Approximating transform..." << std::endl;
+        rt::FieldApproximation info;
+        transform = rt::ApproximateTransform(
+            transform, fixed.size(), tolerance, 16, &info);
+        std::cout << "Approximated transform with a lattice spacing of ";
+        std::cout << info.spacing << " px (max. error over " << info.samples;
+        std::cout << " samples: " << info.maxError << " px)" << std::endl;
+    }
+
+    // Transform and stream TIFFs to disk in bands of rows
+    if (rt::FileExtensionFilter(outputPath, {"tif", "tiff"})) {
+        std::cout << "Transforming and writing image..." << std::endl;
+        rt::io::TIFFWriter writer(outputPath, fixed.size(), moving.type());
+        rt::ImageTransformResampler(
+            moving, fixed.size(), transform,
+            [&writer](int, const cv::Mat& band) { writer.writeRows(band); },
+            interpolation);
+        writer.close();
+        return EXIT_SUCCESS;
     }
 
     // Transform image
     std::cout << "Transforming image..." << std::endl;
-    auto final = rt::ImageTransformResampler(moving, fixed.size(), transform);
+    auto final = rt::ImageTransformResampler(
+        moving, fixed.size(), transform, interpolation);
 
     // Write out the file
     std::cout << "Writing transformed image..." << std::endl;
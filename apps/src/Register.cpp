@@ -1,10 +1,13 @@
 #include <iostream>
 #include <unordered_map>
+#include <vector>
 
 #include <boost/program_options.hpp>
 #include <smgl/Graph.hpp>
 #include <smgl/Graphviz.hpp>
 
+#include "rt/ImageTransformResampler.hpp"
+#include "rt/RegistrationObserver.hpp"
 #include "rt/Version.hpp"
 #include "rt/filesystem.hpp"
 #include "rt/graph.hpp"
@@ -31,7 +34,14 @@ auto main(int argc, char* argv[]) -> int
             "Output file path for the registered moving file")
         ("output-tfm,t", po::value<std::string>(),
             "Output file path for the generated transform file")
-        ("report-metrics", "Outputs the metric values from the deformable and affine");
+        ("report-metrics", "Outputs the metric values from the deformable and affine")
+        ("output-telemetry", po::value<std::string>(),
+            "Write per-iteration statistics from the affine and deformable "
+            "registration stages to this JSON-lines file")
+        ("threads", po::value<unsigned>()->default_value(0),
+            "Maximum number of threads used by deformable registration. If "
+            "0, uses ITK's global default, which is all available cores "
+            "unless limited by ITK_GLOBAL_DEFAULT_NUMBER_OF_THREADS.");
 
     po::options_description graphOptions("Render Graph Options");
     graphOptions.add_options()
@@ -41,7 +51,16 @@ auto main(int argc, char* argv[]) -> int
     po::options_description twoOptions("2D-to-2D Registration Options");
     twoOptions.add_options()
         ("enable-alpha", "If enabled, an alpha layer will be "
-            "added to the moving image if it does not already have one.");
+            "added to the moving image if it does not already have one.")
+        ("interpolation", po::value<std::string>()->default_value("nearest"),
+            "Interpolation used to resample the output image. Options: "
+            "nearest, linear, bspline, sinc")
+        ("preview-levels", po::value<int>()->default_value(0),
+            "Number of downscaled previews of the output image to write "
+            "alongside it. Level n is 1/2^n scale and is written to "
+            "<output>_preview<2^n>.<ext>. Previews are resampled directly "
+            "from the moving image rather than from the full-resolution "
+            "output.");
 
     po::options_description threeOptions("2D-to-3D Registration Options");
     threeOptions.add_options()
@@ -55,14 +74,41 @@ auto main(int argc, char* argv[]) -> int
     ldmOptions.add_options()
         ("disable-landmark", "Disable all landmark registration steps")
         ("disable-landmark-bspline", "Disable secondary B-Spline landmark registration")
-        ("fixed-mask", po::value<std::string>(), "Fixed image mask")
-        ("moving-mask", po::value<std::string>(), "Moving image mask")
+        ("fixed-mask", po::value<std::string>(), "Fixed image mask. Restricts "
+            "landmark detection and deformable metric sampling to the "
+            "non-zero pixels of the mask.")
+        ("moving-mask", po::value<std::string>(), "Moving image mask. "
+            "Restricts landmark detection and deformable metric sampling to "
+            "the non-zero pixels of the mask.")
         ("input-landmarks,l", po::value<std::string>(),
             "Input landmarks file. If not provided, landmark features "
             "are automatically detected from the input images.")
+        ("landmark-detector", po::value<std::string>()->default_value("sift"),
+            "Feature detector for automatic landmark detection. Binary "
+            "detectors are much faster for images of the same modality. "
+            "Options: sift, akaze, orb, brisk")
+        ("landmark-homography",
+            "Use the homography estimated while filtering detected "
+            "landmarks as the initial landmark transform, instead of "
+            "running affine landmark registration. Requires automatic "
+            "landmark detection.")
         ("landmark-match-ratio", po::value<float>()->default_value(0.7F),
             "Matching ratio for automatically detected features. Smaller "
             "values represent closer matches.")
+        ("landmark-tile-size", po::value<int>()->default_value(0),
+            "If positive, features are detected in parallel in tiles of this "
+            "size. Large-scale features can be lost at tile edges. If 0, "
+            "each image is searched as a single tile.")
+        ("landmark-max-image-dim", po::value<int>()->default_value(4096),
+            "Images larger than this size are downscaled before feature "
+            "detection. If 0, features are detected at full resolution.")
+        ("landmark-tile-features", po::value<int>()->default_value(0),
+            "Maximum number of features kept from each detection tile. "
+            "If 0, all features are kept.")
+        ("feature-cache", po::value<std::string>(),
+            "Directory in which detected features are cached and reused "
+            "by later runs with the same image. Defaults to the "
+            "RT_FEATURE_CACHE environment variable, if set.")
         ("output-ldm", po::value<std::string>(),
             "Output file path for the generated landmarks file");
 
@@ -71,10 +117,67 @@ auto main(int argc, char* argv[]) -> int
         ("disable-deformable", "Disable all deformable registration steps")
         ("deformable-iterations,i", po::value<int>()->default_value(100),
             "Number of deformable optimization iterations")
+        ("initial-deformable", po::value<std::string>(),
+            "Transform file used to initialize deformable registration, "
+            "such as a deformable checkpoint. The file must contain exactly "
+            "one B-Spline transform, which is resampled to the current mesh "
+            "size. Use --initial-deformable-index to select the deformable "
+            "stage from a file with several stages, such as one written "
+            "with --output-tfm.")
+        ("initial-deformable-index", po::value<unsigned>(),
+            "Index of the deformable stage in the --initial-deformable "
+            "composite transform. Transforms written with --output-tfm "
+            "list the landmark stages first and the deformable stage last.")
         ("deformable-mesh-size", po::value<unsigned>()->default_value(12),
             "The deformable mesh fill size")
         ("deformable-tolerance", po::value<double>()->default_value(.0001),
-            "The deformable gradient magnitude tolerance");
+            "The deformable gradient magnitude tolerance")
+        ("deformable-levels", po::value<std::size_t>()->default_value(1),
+            "Number of multi-resolution pyramid levels. Each level halves "
+            "the image and mesh size of the level which follows it. "
+            "Max: 16")
+        ("deformable-shrink-factors",
+            po::value<std::vector<unsigned>>()->multitoken(),
+            "Image shrink factor for each pyramid level, ordered from "
+            "coarsest to finest (e.g. 8 4 2 1). Overrides "
+            "--deformable-levels.")
+        ("deformable-level-iterations",
+            po::value<std::vector<std::size_t>>()->multitoken(),
+            "Iteration limit for each pyramid level, ordered from coarsest "
+            "to finest. Levels without a value use --deformable-iterations.")
+        ("deformable-sampling",
+            po::value<std::string>()->default_value("random"),
+            "Deformable metric sampling strategy. Options: random, regular, "
+            "stratified")
+        ("deformable-sampling-percentage",
+            po::value<double>()->default_value(0.0125),
+            "Fraction of fixed image pixels sampled by the deformable "
+            "metric, in the range (0, 1]")
+        ("deformable-histogram-bins",
+            po::value<std::size_t>()->default_value(50),
+            "Number of deformable metric histogram bins")
+        ("deformable-seed", po::value<int>(),
+            "Seed for random and stratified deformable metric sampling. If "
+            "not provided, every run uses a new seed.")
+        ("deformable-engine", po::value<std::string>()->default_value("v4"),
+            "Deformable registration engine. Options: v4, legacy")
+        ("deformable-tile-size", po::value<int>()->default_value(0),
+            "If greater than 0, images larger than this size are registered "
+            "as overlapping tiles of this size. Tiles are registered in "
+            "parallel and blended into a single transform.")
+        ("deformable-tile-overlap", po::value<int>()->default_value(128),
+            "Overlap between neighboring deformable tiles, in pixels")
+        ("deformable-time-budget", po::value<double>()->default_value(0),
+            "Wall-clock time limit for deformable registration, in seconds. "
+            "When exhausted, the best transform found so far is used. If 0, "
+            "there is no limit.")
+        ("deformable-checkpoint", po::value<std::string>(),
+            "Periodically write the best deformable transform found so far "
+            "to this file. Can be passed to --initial-deformable to resume "
+            "an interrupted run.")
+        ("deformable-checkpoint-interval",
+            po::value<double>()->default_value(60),
+            "Minimum time between deformable checkpoints, in seconds");
 
     po::options_description all("Usage");
     all.add(required).add(graphOptions)
@@ -104,6 +207,90 @@ auto main(int argc, char* argv[]) -> int
     fs::path movingPath = parsed["moving"].as<std::string>();
     fs::path outputPath = parsed["output-file"].as<std::string>();
 
+    // Deformable engine
+    DeformableRegistration::Engine deformableEngine;
+    auto engineName = parsed["deformable-engine"].as<std::string>();
+    if (engineName == "v4") {
+        deformableEngine = DeformableRegistration::Engine::V4;
+    } else if (engineName == "legacy") {
+        deformableEngine = DeformableRegistration::Engine::Legacy;
+    } else {
+        std::cerr << "ERROR: Unknown deformable engine: " << engineName;
+        std::cerr << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // The homography is only estimated by automatic landmark detection
+    auto useHomography = parsed.count("landmark-homography") > 0;
+    if (useHomography and (parsed.count("input-landmarks") > 0 or
+                           parsed.count("disable-landmark") > 0)) {
+        std::cerr << "ERROR: --landmark-homography requires automatic ";
+        std::cerr << "landmark detection" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Pyramid levels
+    auto levels = parsed["deformable-levels"].as<std::size_t>();
+    if (levels > DeformableRegistration::MAX_LEVELS) {
+        std::cerr << "ERROR: --deformable-levels must be at most ";
+        std::cerr << DeformableRegistration::MAX_LEVELS << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Landmark feature detector
+    LandmarkDetector::Detector landmarkDetector;
+    auto detectorName = parsed["landmark-detector"].as<std::string>();
+    if (detectorName == "sift") {
+        landmarkDetector = LandmarkDetector::Detector::SIFT;
+    } else if (detectorName == "akaze") {
+        landmarkDetector = LandmarkDetector::Detector::AKAZE;
+    } else if (detectorName == "orb") {
+        landmarkDetector = LandmarkDetector::Detector::ORB;
+    } else if (detectorName == "brisk") {
+        landmarkDetector = LandmarkDetector::Detector::BRISK;
+    } else {
+        std::cerr << "ERROR: Unknown landmark detector: " << detectorName;
+        std::cerr << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Output interpolation
+    Interpolation interpolation;
+    try {
+        interpolation =
+            ParseInterpolation(parsed["interpolation"].as<std::string>());
+    } catch (const std::invalid_argument& e) {
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Deformable sampling strategy
+    DeformableRegistration::Sampling deformableSampling;
+    auto samplingName = parsed["deformable-sampling"].as<std::string>();
+    if (samplingName == "random") {
+        deformableSampling = DeformableRegistration::Sampling::Random;
+    } else if (samplingName == "regular") {
+        deformableSampling = DeformableRegistration::Sampling::Regular;
+    } else if (samplingName == "stratified") {
+        deformableSampling = DeformableRegistration::Sampling::Stratified;
+    } else {
+        std::cerr << "ERROR: Unknown deformable sampling strategy: ";
+        std::cerr << samplingName << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Registration telemetry
+    IterationObserver telemetry;
+    if (parsed.count("output-telemetry") > 0) {
+        try {
+            telemetry = MakeJSONLinesObserver(
+                parsed["output-telemetry"].as<std::string>());
+        } catch (const std::exception& e) {
+            std::cerr << "ERROR: " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
     ///// Start render graph /////
     rt::graph::RegisterNodes();
     smgl::Graph graph;
@@ -146,6 +333,18 @@ auto main(int argc, char* argv[]) -> int
     }
     auto moving = graph.insertNode<ImageReadNode>();
     moving->path = movingPath;
+
+    // Optionally load masks
+    if (parsed.count("fixed-mask") > 0) {
+        auto maskRead = graph.insertNode<ImageReadNode>();
+        maskRead->path = parsed["fixed-mask"].as<std::string>();
+        results["fixedMask"] = &maskRead->image;
+    }
+    if (parsed.count("moving-mask") > 0) {
+        auto maskRead = graph.insertNode<ImageReadNode>();
+        maskRead->path = parsed["moving-mask"].as<std::string>();
+        results["movingMask"] = &maskRead->image;
+    }
     auto compositeTfms = graph.insertNode<CompositeTransformNode>();
 
     ///// Landmark Registration /////
@@ -163,19 +362,25 @@ auto main(int argc, char* argv[]) -> int
             auto genLdm = graph.insertNode<LandmarkDetectorNode>();
             genLdm->fixedImage = *results["fixedImage"];
             genLdm->movingImage = moving->image;
+            genLdm->featureDetector = landmarkDetector;
             genLdm->matchRatio = parsed["landmark-match-ratio"].as<float>();
+            genLdm->tileSize = parsed["landmark-tile-size"].as<int>();
+            genLdm->maxImageDim =
+                parsed["landmark-max-image-dim"].as<int>();
+            genLdm->maxFeaturesPerTile =
+                parsed["landmark-tile-features"].as<int>();
+            if (parsed.count("feature-cache") > 0) {
+                genLdm->featureCacheDir =
+                    parsed["feature-cache"].as<std::string>();
+            }
             ldmNode = genLdm;
 
-            // Optionally load masks
-            if (parsed.count("fixed-mask") > 0) {
-                auto maskRead = graph.insertNode<ImageReadNode>();
-                maskRead->path = parsed["fixed-mask"].as<std::string>();
-                genLdm->fixedMask = maskRead->image;
+            // Optionally use masks
+            if (results.count("fixedMask") > 0) {
+                genLdm->fixedMask = *results["fixedMask"];
             }
-            if (parsed.count("moving-mask") > 0) {
-                auto maskRead = graph.insertNode<ImageReadNode>();
-                maskRead->path = parsed["moving-mask"].as<std::string>();
-                genLdm->movingMask = maskRead->image;
+            if (results.count("movingMask") > 0) {
+                genLdm->movingMask = *results["movingMask"];
             }
 
             // Optionally write generated landmarks to file
@@ -187,20 +392,31 @@ auto main(int argc, char* argv[]) -> int
             }
         }
 
-        // Run affine registration
-        auto affine = graph.insertNode<AffineLandmarkRegistrationNode>();
-        affine->fixedLandmarks = ldmNode->getOutputPort("fixedLandmarks");
-        affine->movingLandmarks = ldmNode->getOutputPort("movingLandmarks");
-        affine->reportMetrics = parsed.count("report-metrics") > 0;
+        // Initial transform: the detection homography or affine
+        // registration
+        smgl::Output* initialTfm{nullptr};
+        if (useHomography) {
+            initialTfm = &ldmNode->getOutputPort("transform");
+        } else {
+            auto affine = graph.insertNode<AffineLandmarkRegistrationNode>();
+            affine->fixedLandmarks = ldmNode->getOutputPort("fixedLandmarks");
+            affine->movingLandmarks =
+                ldmNode->getOutputPort("movingLandmarks");
+            affine->reportMetrics = parsed.count("report-metrics") > 0;
+            if (telemetry) {
+                affine->iterationObserver = telemetry;
+            }
+            initialTfm = &affine->transform;
+        }
 
         // Transform
-        landmarkTfms->first = affine->transform;
+        landmarkTfms->first = *initialTfm;
 
         // B-Spline landmark warping
         if (parsed.count("disable-landmark-bspline") == 0) {
             // Update the landmark positions
             auto tfmLdm = graph.insertNode<TransformLandmarksNode>();
-            tfmLdm->transform = affine->transform;
+            tfmLdm->transform = *initialTfm;
             tfmLdm->landmarksIn = ldmNode->getOutputPort("movingLandmarks");
 
             // BSpline Warp
@@ -217,11 +433,24 @@ auto main(int argc, char* argv[]) -> int
 
     ///// Deformable Registration /////
     if (parsed.count("disable-deformable") == 0) {
-        // Resample moving image for next stage
+        // Resample moving image for next stage. If the moving mask is
+        // resampled too, the landmark transforms are evaluated once into a
+        // field which both share. Otherwise, resample from the transforms
+        // directly, which avoids a dense field and keeps the affine fast
+        // path.
         auto resample1 = graph.insertNode<ImageResampleNode>();
         resample1->fixedImage = *results["fixedImage"];
         resample1->movingImage = moving->image;
-        resample1->transform = landmarkTfms->result;
+        smgl::Output* landmarkField{nullptr};
+        if (results.count("movingMask") > 0) {
+            auto field = graph.insertNode<DeformationFieldNode>();
+            field->fixedImage = *results["fixedImage"];
+            field->transform = landmarkTfms->result;
+            landmarkField = &field->field;
+            resample1->deformationField = *landmarkField;
+        } else {
+            resample1->transform = landmarkTfms->result;
+        }
 
         // Compute deformable
         auto deformable = graph.insertNode<DeformableRegistrationNode>();
@@ -230,9 +459,85 @@ auto main(int argc, char* argv[]) -> int
             parsed["deformable-mesh-size"].as<unsigned>();
         deformable->gradientTolerance =
             parsed["deformable-tolerance"].as<double>();
+        deformable->levels = levels;
+        deformable->engine = deformableEngine;
+        deformable->samplingStrategy = deformableSampling;
+        deformable->samplingPercentage =
+            parsed["deformable-sampling-percentage"].as<double>();
+        deformable->histogramBins =
+            parsed["deformable-histogram-bins"].as<std::size_t>();
+        if (parsed.count("deformable-seed") > 0) {
+            deformable->randomSeed = parsed["deformable-seed"].as<int>();
+        }
+        deformable->numberOfThreads = parsed["threads"].as<unsigned>();
+        deformable->tileSize = parsed["deformable-tile-size"].as<int>();
+        deformable->tileOverlap = parsed["deformable-tile-overlap"].as<int>();
+        deformable->timeBudget = parsed["deformable-time-budget"].as<double>();
+        if (parsed.count("deformable-checkpoint") > 0) {
+            deformable->checkpointPath =
+                parsed["deformable-checkpoint"].as<std::string>();
+        }
+        deformable->checkpointInterval =
+            parsed["deformable-checkpoint-interval"].as<double>();
+        if (parsed.count("deformable-shrink-factors") > 0) {
+            deformable->shrinkFactors =
+                parsed["deformable-shrink-factors"].as<std::vector<unsigned>>();
+        }
+        if (parsed.count("deformable-level-iterations") > 0) {
+            deformable->levelIterations =
+                parsed["deformable-level-iterations"]
+                    .as<std::vector<std::size_t>>();
+        }
         deformable->fixedImage = *results["fixedImage"];
         deformable->movingImage = resample1->resampledImage;
+
+        // Optionally continue from a previous result
+        if (parsed.count("initial-deformable") > 0) {
+            Transform::Pointer initial;
+            try {
+                initial = ReadTransform(
+                    parsed["initial-deformable"].as<std::string>());
+            } catch (const std::exception& e) {
+                std::cerr << "ERROR: Failed to read --initial-deformable: ";
+                std::cerr << e.what() << std::endl;
+                return EXIT_FAILURE;
+            }
+            if (parsed.count("initial-deformable-index") > 0) {
+                auto idx = parsed["initial-deformable-index"].as<unsigned>();
+                auto* composite =
+                    dynamic_cast<CompositeTransform*>(initial.GetPointer());
+                if (composite == nullptr or
+                    idx >= composite->GetNumberOfTransforms()) {
+                    std::cerr << "ERROR: --initial-deformable has no ";
+                    std::cerr << "transform at index " << idx << std::endl;
+                    return EXIT_FAILURE;
+                }
+                initial = composite->GetNthTransform(idx).GetPointer();
+            }
+            try {
+                deformable->initialTransform = initial;
+            } catch (const std::invalid_argument& e) {
+                std::cerr << "ERROR: " << e.what() << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+
+        // Optionally restrict sampling to masks. The moving mask is
+        // resampled into the same space as the moving image.
+        if (results.count("fixedMask") > 0) {
+            deformable->fixedMask = *results["fixedMask"];
+        }
+        if (results.count("movingMask") > 0) {
+            auto resampleMask = graph.insertNode<ImageResampleNode>();
+            resampleMask->fixedImage = *results["fixedImage"];
+            resampleMask->movingImage = *results["movingMask"];
+            resampleMask->deformationField = *landmarkField;
+            deformable->movingMask = resampleMask->resampledImage;
+        }
         deformable->reportMetrics = parsed.count("report-metrics") > 0;
+        if (telemetry) {
+            deformable->iterationObserver = telemetry;
+        }
 
         // Add transform to final composite
         compositeTfms->second = deformable->transform;
@@ -262,17 +567,51 @@ auto main(int argc, char* argv[]) -> int
 
     // Handle 2D-to-2D registration
     else {
-        ///// Resample the source image /////
-        auto resample2 = graph.insertNode<ImageResampleNode>();
-        resample2->fixedImage = *results["fixedImage"];
-        resample2->movingImage = moving->image;
-        resample2->transform = compositeTfms->result;
-        resample2->forceAlpha = parsed.count("enable-alpha") > 0;
-
-        ///// Write the output image /////
-        auto writer = graph.insertNode<ImageWriteNode>();
-        writer->path = outputPath;
-        writer->image = resample2->resampledImage;
+        ///// Write previews /////
+        // Inserted smallest first and ahead of the full-resolution output so
+        // that the cheapest preview is available as early as possible
+        auto previewLevels = parsed["preview-levels"].as<int>();
+        for (auto level = previewLevels; level > 0; level--) {
+            auto factor = 1 << level;
+            auto preview = graph.insertNode<ImagePreviewNode>();
+            preview->fixedImage = *results["fixedImage"];
+            preview->movingImage = moving->image;
+            preview->transform = compositeTfms->result;
+            preview->scale = 1. / factor;
+            preview->forceAlpha = parsed.count("enable-alpha") > 0;
+            preview->interpolation = interpolation;
+
+            auto name = outputPath.stem().string() + "_preview" +
+                        std::to_string(factor) +
+                        outputPath.extension().string();
+            auto writer = graph.insertNode<ImageWriteNode>();
+            writer->path = outputPath.parent_path() / name;
+            writer->image = preview->previewImage;
+        }
+
+        ///// Resample and write the source image /////
+        // TIFFs are streamed to disk in bands of rows rather than being
+        // resampled into memory first
+        if (IsFormat(outputPath, {"tif", "tiff"})) {
+            auto resample2 = graph.insertNode<ImageResampleWriteNode>();
+            resample2->path = outputPath;
+            resample2->fixedImage = *results["fixedImage"];
+            resample2->movingImage = moving->image;
+            resample2->transform = compositeTfms->result;
+            resample2->forceAlpha = parsed.count("enable-alpha") > 0;
+            resample2->interpolation = interpolation;
+        } else {
+            auto resample2 = graph.insertNode<ImageResampleNode>();
+            resample2->fixedImage = *results["fixedImage"];
+            resample2->movingImage = moving->image;
+            resample2->transform = compositeTfms->result;
+            resample2->forceAlpha = parsed.count("enable-alpha") > 0;
+            resample2->interpolation = interpolation;
+
+            auto writer = graph.insertNode<ImageWriteNode>();
+            writer->path = outputPath;
+            writer->image = resample2->resampledImage;
+        }
     }
 
     ///// Write the final transformations /////
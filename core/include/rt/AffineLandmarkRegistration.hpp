@@ -5,6 +5,7 @@
 #include <itkAffineTransform.h>
 
 #include "rt/LandmarkRegistrationBase.hpp"
+#include "rt/RegistrationObserver.hpp"
 
 namespace rt
 {
@@ -24,6 +25,14 @@ public:
     /** @copydoc setReportMetrics(bool) */
     [[nodiscard]] auto getReportMetrics() -> bool;
 
+    /**
+     * @brief Set an observer which receives the registration statistics
+     *
+     * The transform is solved in closed form, so a single record is
+     * reported for every call to compute().
+     */
+    void setIterationObserver(IterationObserver o);
+
     /** @brief Compute the transform */
     auto compute() -> Transform::Pointer;
 
@@ -35,5 +44,7 @@ private:
     Transform::Pointer output_;
     /** Report error metrics during processing */
     bool reportMetrics_{false};
+    /** Iteration observer */
+    IterationObserver observer_;
 };
 }  // namespace rt
\ No newline at end of file
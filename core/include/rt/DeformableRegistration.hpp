@@ -2,9 +2,16 @@
 
 /** @file */
 
+#include <chrono>
+#include <vector>
+
 #include <itkBSplineTransform.h>
 #include <opencv2/core.hpp>
 
+#include "rt/RegistrationObserver.hpp"
+#include "rt/filesystem.hpp"
+#include "rt/types/Transforms.hpp"
+
 namespace rt
 {
 
@@ -16,8 +23,22 @@ namespace rt
  * images. Assumes the input images have already been roughly aligned using
  * some sort of landmark registration algorithm.
  *
- * This class is a simplified wrapper around ITK's ImageRegistrationMethod. If
- * you want fine-grained control, you should probably use that instead.
+ * This class is a simplified wrapper around ITK's ImageRegistrationMethodv4
+ * (or, optionally, the legacy ImageRegistrationMethod). If you want
+ * fine-grained control, you should probably use that instead.
+ *
+ * Registration can optionally be run as a coarse-to-fine image pyramid. Each
+ * level registers shrunken copies of the input images, and the B-Spline
+ * control grid is refined between levels so that the final level is solved on
+ * the full-resolution images with the requested mesh fill size. Most
+ * optimizer iterations can then be spent on small images.
+ *
+ * For very large images, registration can also be run in tiled mode. The
+ * fixed image domain is split into overlapping tiles which are registered
+ * independently and in parallel. The per-tile results are then blended into
+ * a single B-Spline transform whose mesh is as dense as the combined tile
+ * meshes. Working memory is bounded by the tile size rather than the image
+ * size.
  *
  */
 class DeformableRegistration
@@ -31,14 +52,58 @@ public:
     static constexpr double DEFAULT_GRAD_MAG_TOLERANCE = 0.0001;
     /** Default mesh fill size */
     static constexpr uint32_t DEFAULT_MESH_FILL_SIZE = 12;
+    /** Default number of pyramid levels */
+    static constexpr size_t DEFAULT_LEVELS = 1;
+    /** Maximum number of pyramid levels (coarsest shrink factor 2^15) */
+    static constexpr size_t MAX_LEVELS = 16;
+    /** Default tile overlap, in pixels */
+    static constexpr int DEFAULT_TILE_OVERLAP = 128;
+    /** Default number of metric histogram bins */
+    static constexpr size_t DEFAULT_HISTOGRAM_BINS = 50;
+    /** Default fraction of fixed image pixels sampled by the metric */
+    static constexpr double DEFAULT_SAMPLING_PERCENTAGE = 1.0 / 80.0;
+    /** Default time between checkpoints, in seconds */
+    static constexpr double DEFAULT_CHECKPOINT_INTERVAL = 60.0;
     /** BSpline transform type */
     using Transform = itk::BSplineTransform<double, 2, 3>;
 
+    /** @brief Registration engine */
+    enum class Engine {
+        /** ImageRegistrationMethodv4 with the v4 metric and optimizer */
+        V4,
+        /** Legacy ImageRegistrationMethod */
+        Legacy
+    };
+
+    /** @brief Metric sampling strategy */
+    enum class Sampling {
+        /** Each pixel is sampled independently at random */
+        Random,
+        /** Pixels are sampled on a regular grid */
+        Regular,
+        /** One randomly placed sample in each cell of a regular grid */
+        Stratified
+    };
+
     /**@{*/
     /** @brief Set the fixed (target) image for registration */
     void setFixedImage(const cv::Mat& i);
     /** @brief Set the moving (transformed) image for registration */
     void setMovingImage(const cv::Mat& i);
+    /**
+     * @brief Set the fixed image mask
+     *
+     * If provided, metric samples are only drawn from the non-zero pixels of
+     * the mask. Must be the same size as the fixed image.
+     */
+    void setFixedMask(const cv::Mat& m);
+    /**
+     * @brief Set the moving image mask
+     *
+     * If provided, metric samples which map outside the non-zero pixels of
+     * the mask are ignored. Must be the same size as the moving image.
+     */
+    void setMovingMask(const cv::Mat& m);
     /**
      * @brief Set optimizer iteration limit
      *
@@ -47,19 +112,187 @@ public:
     void setNumberOfIterations(size_t i);
     /** @brief Set the Mesh Fill Size */
     void setMeshFillSize(uint32_t i);
+    /**
+     * @brief Set a transform to continue optimizing from
+     *
+     * Accepts a B-Spline transform, such as a checkpoint, or a composite
+     * transform which contains exactly one B-Spline transform. B-Spline
+     * landmark warps have the same type as deformable stages, so composites
+     * which contain both are rejected. Select the deformable stage from such
+     * a composite before passing it to this function. The transform's control
+     * grid is resampled to the fixed image domain and the first level's mesh
+     * size, so it does not need to match the current settings. Pass nullptr
+     * to start from the identity transform.
+     *
+     * @throws std::invalid_argument if the transform does not contain
+     * exactly one B-Spline transform
+     */
+    void setInitialTransform(const rt::Transform::Pointer& t);
+    /**
+     * @brief Set the number of pyramid levels
+     *
+     * Each level shrinks the images by a factor of two relative to the level
+     * which follows it, i.e. 3 levels produces the shrink factors
+     * `{4, 2, 1}`. The B-Spline mesh size is likewise halved for every
+     * coarser level. Ignored if shrink factors have been set with
+     * setShrinkFactors().
+     *
+     * @throws std::invalid_argument if i is greater than MAX_LEVELS
+     */
+    void setNumberOfLevels(size_t i);
+    /**
+     * @brief Set the per-level image shrink factors
+     *
+     * Factors are ordered from the coarsest to the finest level, and the
+     * number of factors determines the number of pyramid levels. The last
+     * factor should normally be 1 so that the final level is computed on the
+     * full-resolution images. Pass an empty list to return to the schedule
+     * generated by setNumberOfLevels().
+     *
+     * @throws std::invalid_argument if any factor is zero
+     */
+    void setShrinkFactors(const std::vector<unsigned>& f);
+    /**
+     * @brief Set the per-level optimizer iteration limits
+     *
+     * Limits are ordered from the coarsest to the finest level. If empty or
+     * shorter than the number of levels, levels without an entry use the
+     * limit set by setNumberOfIterations().
+     */
+    void setIterationsPerLevel(const std::vector<size_t>& i);
+    /**
+     * @brief Set the metric sampling strategy
+     *
+     * Sample positions are always visited in row-major order. Regular
+     * sampling is fully deterministic.
+     */
+    void setSamplingStrategy(Sampling s);
+    /**
+     * @brief Set the fraction of fixed image pixels sampled by the metric
+     *
+     * Smooth images with little detail can use ~1% of the pixels, while
+     * detailed images may need as many as 20%.
+     *
+     * @throws std::invalid_argument if not in the range (0, 1]
+     */
+    void setSamplingPercentage(double p);
+    /**
+     * @brief Set the number of metric histogram bins
+     *
+     * The metric is relatively insensitive to this value. 50 bins is
+     * sufficient for most applications.
+     *
+     * @throws std::invalid_argument if 0
+     */
+    void setHistogramBins(size_t b);
+    /**
+     * @brief Set the seed for random and stratified sampling
+     *
+     * If negative (default), a new seed is drawn for every run.
+     */
+    void setRandomSeed(int s);
     /** @brief Set the Gradient Magnitude Tolerance */
     void setGradientMagnitudeTolerance(double i);
+    /**
+     * @brief Set a wall-clock time budget for compute(), in seconds
+     *
+     * Once the budget is exhausted, the optimizer is stopped after its
+     * current iteration and the best parameters evaluated so far are kept.
+     * Remaining pyramid levels and tiles are skipped. If 0 (default), there
+     * is no time limit.
+     */
+    void setTimeBudget(double seconds);
+    /**
+     * @brief Periodically write the best transform so far to this file
+     *
+     * The file is replaced atomically, so it always holds a complete
+     * transform which can be passed to setInitialTransform(). Checkpoints are
+     * not written in tiled mode. If empty (default), checkpoints are
+     * disabled.
+     */
+    void setCheckpointPath(const filesystem::path& p);
+    /** @brief Set the minimum time between checkpoints, in seconds */
+    void setCheckpointInterval(double seconds);
     /** @brief Report error metrics to the console while processing */
     void setReportMetrics(bool i);
+    /**
+     * @brief Set an observer which receives statistics for every optimizer
+     * iteration
+     *
+     * In tiled mode, the observer is called concurrently from multiple
+     * tiles and must be thread-safe.
+     */
+    void setIterationObserver(IterationObserver o);
+    /**
+     * @brief Set the registration engine
+     *
+     * The v4 engine is the default and scales better across cores. The legacy
+     * engine is kept for comparison with previous results.
+     */
+    void setEngine(Engine e);
+    /**
+     * @brief Set the maximum number of threads used by the registration
+     *
+     * If 0 (default), uses ITK's global default, which is all available
+     * cores unless limited by the `ITK_GLOBAL_DEFAULT_NUMBER_OF_THREADS`
+     * environment variable.
+     */
+    void setNumberOfThreads(unsigned i);
+    /**
+     * @brief Set the tile size for tiled registration
+     *
+     * If greater than 0 and the fixed image is larger than this size in
+     * either dimension, registration is run on square tiles of this size.
+     * The mesh fill size is applied to every tile. If 0 (default), the image
+     * is registered as a single region.
+     */
+    void setTileSize(int i);
+    /**
+     * @brief Set the tile overlap for tiled registration
+     *
+     * Each tile is extended by this many pixels on every side. Per-tile
+     * results are blended across the overlapping regions.
+     */
+    void setTileOverlap(int i);
     /**@}*/
 
     /**@{*/
     /** @brief Get the Mesh Fill Size */
     [[nodiscard]] auto getMeshFillSize() const -> uint32_t;
+    /** @brief Get the B-Spline initial transform */
+    [[nodiscard]] auto getInitialTransform() const -> Transform::Pointer;
+    /** @copydoc setNumberOfLevels(size_t) */
+    [[nodiscard]] auto getNumberOfLevels() const -> size_t;
+    /** @copydoc setShrinkFactors(const std::vector<unsigned>&) */
+    [[nodiscard]] auto getShrinkFactors() const -> std::vector<unsigned>;
+    /** @copydoc setIterationsPerLevel(const std::vector<size_t>&) */
+    [[nodiscard]] auto getIterationsPerLevel() const -> std::vector<size_t>;
+    /** @copydoc setSamplingStrategy(Sampling) */
+    [[nodiscard]] auto getSamplingStrategy() const -> Sampling;
+    /** @copydoc setSamplingPercentage(double) */
+    [[nodiscard]] auto getSamplingPercentage() const -> double;
+    /** @copydoc setHistogramBins(size_t) */
+    [[nodiscard]] auto getHistogramBins() const -> size_t;
+    /** @copydoc setRandomSeed(int) */
+    [[nodiscard]] auto getRandomSeed() const -> int;
     /** @brief Get the Gradient Magnitude Tolerance */
     [[nodiscard]] auto getGradientMagnitudeTolerance() const -> double;
+    /** @copydoc setTimeBudget(double) */
+    [[nodiscard]] auto getTimeBudget() const -> double;
+    /** @copydoc setCheckpointPath(const filesystem::path&) */
+    [[nodiscard]] auto getCheckpointPath() const -> filesystem::path;
+    /** @copydoc setCheckpointInterval(double) */
+    [[nodiscard]] auto getCheckpointInterval() const -> double;
     /** @copydoc setReportMetrics(bool) */
     [[nodiscard]] auto getReportMetrics() const -> bool;
+    /** @copydoc setEngine(Engine) */
+    [[nodiscard]] auto getEngine() const -> Engine;
+    /** @copydoc setNumberOfThreads(unsigned) */
+    [[nodiscard]] auto getNumberOfThreads() const -> unsigned;
+    /** @copydoc setTileSize(int) */
+    [[nodiscard]] auto getTileSize() const -> int;
+    /** @copydoc setTileOverlap(int) */
+    [[nodiscard]] auto getTileOverlap() const -> int;
     /**@}*/
 
     /**@{*/
@@ -73,23 +306,76 @@ public:
     /**@}*/
 
 private:
+    /** Get the shrink factor schedule used by compute() */
+    [[nodiscard]] auto shrinkSchedule_() const -> std::vector<unsigned>;
+    /** Run registration in tiled mode */
+    auto computeTiled_() -> Transform::Pointer;
+    /** Run the pyramid levels on grayscale images of the given ITK type */
+    template <typename TImage>
+    auto computeLevels_(
+        const cv::Mat& fixedImg,
+        const cv::Mat& movingImg,
+        const cv::Mat& fixedMask,
+        const cv::Mat& movingMask) -> Transform::Pointer;
+
     /** Fixed input image */
     cv::Mat fixedImage_;
     /** Moving input image */
     cv::Mat movingImage_;
+    /** Fixed image mask */
+    cv::Mat fixedMask_;
+    /** Moving image mask */
+    cv::Mat movingMask_;
 
     /** Output BSpline transform */
     Transform::Pointer output_;
+    /** Initial BSpline transform */
+    Transform::Pointer initial_;
 
     /** Optimizer iteration limit */
     size_t iterations_{DEFAULT_ITERATIONS};
     /** Mesh fill size */
     uint32_t meshFillSize_{DEFAULT_MESH_FILL_SIZE};
+    /** Number of pyramid levels */
+    size_t levels_{DEFAULT_LEVELS};
+    /** User-provided shrink factors */
+    std::vector<unsigned> shrinkFactors_;
+    /** User-provided per-level iteration limits */
+    std::vector<size_t> levelIters_;
     /** Optimizer step length is reduced by this factor each iteration */
     double relaxationFactor_{DEFAULT_RELAXATION};
+    /** Metric sampling strategy */
+    Sampling sampling_{Sampling::Random};
+    /** Metric sampling percentage */
+    double samplingPct_{DEFAULT_SAMPLING_PERCENTAGE};
+    /** Metric histogram bins */
+    size_t histogramBins_{DEFAULT_HISTOGRAM_BINS};
+    /** Sampling seed */
+    int seed_{-1};
     /** Stop condition if change in metric is less than this value */
     double gradMagTol_{DEFAULT_GRAD_MAG_TOLERANCE};
     /** Report error metrics during processing */
     bool reportMetrics_{false};
+    /** Iteration observer */
+    IterationObserver observer_;
+    /** Tile index when registering a tile */
+    int tile_{-1};
+    /** Time budget */
+    double timeBudget_{0};
+    /** Time at which the budget is exhausted */
+    std::chrono::steady_clock::time_point deadline_{
+        std::chrono::steady_clock::time_point::max()};
+    /** Checkpoint file */
+    filesystem::path checkpointPath_;
+    /** Time between checkpoints */
+    double checkpointInterval_{DEFAULT_CHECKPOINT_INTERVAL};
+    /** Registration engine */
+    Engine engine_{Engine::V4};
+    /** Max number of threads */
+    unsigned threads_{0};
+    /** Tile size */
+    int tileSize_{0};
+    /** Tile overlap */
+    int tileOverlap_{DEFAULT_TILE_OVERLAP};
 };
 }  // namespace rt
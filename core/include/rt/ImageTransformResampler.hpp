@@ -2,19 +2,182 @@
 
 /** @file */
 
+#include <functional>
+#include <string>
+#include <vector>
+
 #include <opencv2/core.hpp>
 
+#include "rt/ITKImageTypes.hpp"
 #include "rt/types/Transforms.hpp"
 
 namespace rt
 {
 
+/** @brief Interpolation kernels used when resampling images */
+enum class Interpolation {
+    /** Nearest neighbor */
+    Nearest,
+    /** Bilinear */
+    Linear,
+    /** Cubic B-spline */
+    BSpline,
+    /** Lanczos-windowed sinc with a radius of 4 pixels */
+    WindowedSinc
+};
+
+/**
+ * @brief Get an Interpolation from its command line name
+ *
+ * Accepts "nearest", "linear", "bspline" and "sinc".
+ *
+ * @throws std::invalid_argument if the name is not recognized
+ */
+auto ParseInterpolation(const std::string& name) -> Interpolation;
+
+/**
+ * @brief Receives a band of resampled rows
+ *
+ * The first parameter is the index of the band's first row in the output
+ * image.
+ */
+using ResampledBandCallback = std::function<void(int, const cv::Mat&)>;
+
+/**
+ * @brief Evaluate a transform at every pixel of an image of size s.
+ *
+ * Each pixel of the returned field holds the displacement
+ * \f$T(p) - p\f$ for the output pixel position p. Rows are evaluated in
+ * parallel. The resulting field can be passed to ImageTransformResampler so
+ * that any number of images and channels can be resampled into the same
+ * fixed geometry while paying for the transform only once.
+ */
+auto ComputeDeformationField(
+    const Transform::Pointer& transform, const cv::Size& s)
+    -> DeformationField::Pointer;
+
+/**
+ * @brief Accuracy of an approximate deformation field
+ *
+ * @see ApproximateDeformationField
+ */
+struct FieldApproximation {
+    /** Spacing of the final control lattice in pixels */
+    int spacing{0};
+    /** Number of pixels at which the error was measured */
+    int samples{0};
+    /** Largest measured distance from the exact mapping in pixels */
+    double maxError{0};
+};
+
+/**
+ * @brief Approximate ComputeDeformationField by evaluating the transform on
+ * a coarse control lattice.
+ *
+ * The transform is evaluated exactly at every spacing-th pixel of each axis
+ * and along the last row and column. Positions in between are bilinearly
+ * interpolated from the four surrounding lattice points. Affine transforms
+ * are reproduced exactly. This is much faster than exact evaluation for
+ * long composites of deformable transforms, and is intended for previews
+ * and review.
+ *
+ * The error is measured against the exact transform at a fixed, random
+ * subset of pixels. While the largest error exceeds tolerance, the lattice
+ * spacing is halved and the field is rebuilt. At a spacing of 1, the exact
+ * field is returned.
+ *
+ * @param tolerance Largest acceptable error in pixels
+ * @param spacing Initial lattice spacing in pixels
+ * @param report If not null, receives the accuracy of the returned field
+ *
+ * @throws std::invalid_argument if the transform is null or spacing is not
+ * positive
+ */
+auto ApproximateDeformationField(
+    const Transform::Pointer& transform,
+    const cv::Size& s,
+    double tolerance,
+    int spacing = 16,
+    FieldApproximation* report = nullptr) -> DeformationField::Pointer;
+
+/**
+ * @brief Approximate a transform by a coarse control lattice without
+ * building a full field
+ *
+ * Like ApproximateDeformationField, but returns a displacement field
+ * transform which only stores the lattice. The lattice is evaluated at every
+ * spacing-th pixel, extending past the last row and column, and is
+ * interpolated bilinearly. Use this with the band streaming
+ * ImageTransformResampler to approximate outputs which are too large to hold
+ * in memory. At a spacing of 1, the input transform is returned.
+ *
+ * @throws std::invalid_argument if the transform is null or spacing is not
+ * positive
+ */
+auto ApproximateTransform(
+    const Transform::Pointer& transform,
+    const cv::Size& s,
+    double tolerance,
+    int spacing = 16,
+    FieldApproximation* report = nullptr) -> Transform::Pointer;
+
 /**
  * @brief Resample a moving image using a pre-generated transform. Output image
  * is of size s.
  *
+ * Images of every OpenCV depth and channel count are resampled at their own
+ * depth.
  */
 auto ImageTransformResampler(
-    const cv::Mat& m, const cv::Size& s, const Transform::Pointer& transform)
-    -> cv::Mat;
-}  // namespace rt
\ No newline at end of file
+    const cv::Mat& m,
+    const cv::Size& s,
+    const Transform::Pointer& transform,
+    Interpolation interpolation = Interpolation::Nearest) -> cv::Mat;
+
+/**
+ * @brief Resample a moving image using a pre-computed deformation field.
+ * Output image is the size of the field.
+ *
+ * All channels are resampled in a single pass.
+ *
+ * @see ComputeDeformationField
+ */
+auto ImageTransformResampler(
+    const cv::Mat& m,
+    const DeformationField::Pointer& field,
+    Interpolation interpolation = Interpolation::Nearest) -> cv::Mat;
+
+/**
+ * @brief Resample a batch of moving images using one pre-computed
+ * deformation field. Output images are the size of the field.
+ *
+ * The field is converted to a coordinate map once for the whole batch, and
+ * the images are resampled in parallel. Use this to apply one transform to
+ * many co-registered images, such as the bands of a multispectral capture.
+ *
+ * @see ComputeDeformationField
+ */
+auto ImageTransformResampler(
+    const std::vector<cv::Mat>& images,
+    const DeformationField::Pointer& field,
+    Interpolation interpolation = Interpolation::Nearest)
+    -> std::vector<cv::Mat>;
+
+/**
+ * @brief Resample a moving image in bands of rows. Output image is of size
+ * s.
+ *
+ * Bands of up to bandRows rows are passed to the callback in order from top
+ * to bottom. The callback runs on a separate thread, concurrently with
+ * resampling of the next band, so peak memory is about two bands plus the
+ * moving image. Use this with io::TIFFWriter to write outputs which are too
+ * large to hold in memory.
+ */
+void ImageTransformResampler(
+    const cv::Mat& m,
+    const cv::Size& s,
+    const Transform::Pointer& transform,
+    const ResampledBandCallback& callback,
+    Interpolation interpolation = Interpolation::Nearest,
+    int bandRows = 256);
+}  // namespace rt
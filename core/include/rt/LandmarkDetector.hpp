@@ -7,6 +7,8 @@
 #include <opencv2/core.hpp>
 
 #include "rt/LandmarkRegistrationBase.hpp"
+#include "rt/filesystem.hpp"
+#include "rt/types/Transforms.hpp"
 
 namespace rt
 {
@@ -22,14 +24,35 @@ using LandmarkPair = std::pair<cv::Point2f, cv::Point2f>;
  * @brief Automatically generate landmark pairs between a two images
  * @author Ali Bertelsman
  *
- * Uses AKAZE feature descriptors to generate pairs of matching key points
- * between two images. To create key points bounded by a region of interest,
- * set the mask for either the static or moving image.
+ * Uses feature descriptors to generate pairs of matching key points between
+ * two images. The feature detector is selectable with setDetector(). To
+ * create key points bounded by a region of interest, set the mask for either
+ * the static or moving image.
+ *
+ * Features can optionally be detected in overlapping tiles. See
+ * setTileSize(). The tiles of both images are processed together in
+ * parallel on the shared OpenCV thread pool.
+ *
+ * Detected features can be cached on disk so that images which are
+ * registered repeatedly, such as a shared fixed reference, are only searched
+ * once. See setFeatureCacheDir().
  *
  */
 class LandmarkDetector
 {
 public:
+    /** @brief Feature detector and descriptor */
+    enum class Detector {
+        /** SIFT with float descriptors */
+        SIFT,
+        /** AKAZE with binary descriptors */
+        AKAZE,
+        /** ORB with binary descriptors */
+        ORB,
+        /** BRISK with binary descriptors */
+        BRISK
+    };
+
     /** @brief Set the fixed image */
     void setFixedImage(const cv::Mat& img);
     /** @brief Set the fixed image mask */
@@ -38,6 +61,17 @@ public:
     void setMovingImage(const cv::Mat& img);
     /** @brief Set the fixed image mask */
     void setMovingMask(const cv::Mat& img);
+    /**
+     * @brief Feature detector
+     *
+     * Float descriptors (SIFT) are matched with a FLANN KD-tree. Binary
+     * descriptors (AKAZE, ORB, BRISK) are matched by brute force using the
+     * Hamming distance, which is much faster for images of the same
+     * modality. Default: Detector::SIFT
+     */
+    void setDetector(Detector d);
+    /** @copydoc setDetector(Detector) */
+    [[nodiscard]] auto detector() const -> Detector;
     /** @brief The nearest-neighbor matching ratio */
     void setMatchRatio(float r);
     /** @copydoc setMatchRatio(float) */
@@ -46,11 +80,66 @@ public:
      * @brief Maximum image dimension
      *
      * Images with any dimension larger than this size will be
-     * downscaled before landmark detection.
+     * downscaled before landmark detection. If 0, images are searched at
+     * full resolution, which finds finer features in large images. Use with
+     * tiling and setMaxFeaturesPerTile(int) to bound time and memory.
      */
     void setMaxImageDim(int s);
     /** @copydoc setMaxImageDim(int) */
     [[nodiscard]] auto maxImageDim() const -> int;
+    /**
+     * @brief Feature detection tile size
+     *
+     * Images are split into tiles of this size, which are searched for
+     * features in parallel. Each tile is extended by the tile overlap on
+     * every side so that features near tile edges see their full
+     * neighborhood, and keeps only the features whose centers fall inside
+     * the tile itself. If 0 (default), each image is searched as a single
+     * tile.
+     *
+     * Large-scale features whose support extends further than the overlap
+     * can be lost at tile edges, so tiling can change the detected
+     * landmarks.
+     */
+    void setTileSize(int s);
+    /** @copydoc setTileSize(int) */
+    [[nodiscard]] auto tileSize() const -> int;
+    /**
+     * @brief Overlap between feature detection tiles
+     *
+     * @see setTileSize(int)
+     */
+    void setTileOverlap(int s);
+    /** @copydoc setTileOverlap(int) */
+    [[nodiscard]] auto tileOverlap() const -> int;
+    /**
+     * @brief Maximum number of features kept from each tile
+     *
+     * The features with the strongest detector response are kept. Capping
+     * features per tile rather than per image keeps features spread across
+     * the whole image. If 0, all features are kept.
+     */
+    void setMaxFeaturesPerTile(int n);
+    /** @copydoc setMaxFeaturesPerTile(int) */
+    [[nodiscard]] auto maxFeaturesPerTile() const -> int;
+    /**
+     * @brief Feature cache directory
+     *
+     * If not empty, the features of each image are saved to this directory
+     * and reused by later runs. Cache entries are keyed by a hash of the
+     * image, its mask, and the detection parameters, so changing any of
+     * them produces a new entry. Defaults to DefaultFeatureCacheDir().
+     */
+    void setFeatureCacheDir(const filesystem::path& dir);
+    /** @copydoc setFeatureCacheDir(const filesystem::path&) */
+    [[nodiscard]] auto featureCacheDir() const -> filesystem::path;
+    /**
+     * @brief Default feature cache directory
+     *
+     * The value of the `RT_FEATURE_CACHE` environment variable, or an empty
+     * path (no caching) if it is not set.
+     */
+    static auto DefaultFeatureCacheDir() -> filesystem::path;
 
     /** @brief Compute key point matches between the fixed and moving images
      *
@@ -72,6 +161,31 @@ public:
     /** @brief Get the detected landmarks for the moving image */
     [[nodiscard]] auto getMovingLandmarks() const -> LandmarkContainer;
 
+    /**
+     * @brief Get the homography estimated while filtering matches
+     *
+     * compute() uses RANSAC to fit a homography to the matched features and
+     * rejects the matches which do not agree with it. Returns this
+     * homography as a 3x3 CV_64F matrix which maps full resolution fixed
+     * image pixels to moving image pixels. Empty if compute() has not been
+     * called.
+     */
+    [[nodiscard]] auto getHomography() const -> cv::Mat;
+
+    /**
+     * @brief Get the homography as an affine transform
+     *
+     * ITK has no 2D projective transform, so the homography is approximated
+     * by the affine transform which best fits it, in a least squares sense,
+     * over the extent of the fixed image. Like the transforms produced by
+     * AffineLandmarkRegistration, the result maps fixed image points to
+     * moving image points, and can be used in place of them to initialize
+     * later registration stages.
+     *
+     * @throws std::runtime_error if the homography has not been computed
+     */
+    [[nodiscard]] auto getHomographyTransform() const -> Transform::Pointer;
+
 private:
     /** Fixed image */
     cv::Mat fixedImg_;
@@ -83,9 +197,23 @@ private:
     cv::Mat movingMask_;
     /** Matched pairs */
     std::vector<LandmarkPair> output_;
+    /** Fixed to moving homography */
+    cv::Mat homography_;
+    /** Size of the fixed image which the homography was computed for */
+    cv::Size homographySize_;
+    /** Feature detector */
+    Detector detector_{Detector::SIFT};
     /** Nearest-neighbor matching ratio */
     float nnMatchRatio_{0.7F};
     /** Maximum image size for feature detection */
     int maxImageDim_{4096};
+    /** Feature detection tile size */
+    int tileSize_{0};
+    /** Feature detection tile overlap */
+    int tileOverlap_{128};
+    /** Maximum features per tile */
+    int maxTileFeatures_{0};
+    /** Feature cache directory */
+    filesystem::path cacheDir_{DefaultFeatureCacheDir()};
 };
 }  // namespace rt
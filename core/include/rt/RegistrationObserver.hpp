@@ -0,0 +1,62 @@
+#pragma once
+
+/** @file */
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+#include "rt/filesystem.hpp"
+
+namespace rt
+{
+
+/**
+ * @brief Per-iteration optimizer statistics
+ *
+ * Reported by registration classes to an IterationObserver after every
+ * optimizer iteration. All times are in seconds.
+ */
+struct IterationInfo {
+    /** Registration stage which produced this record (e.g. "deformable") */
+    std::string stage;
+    /** Tile index in tiled mode, or -1 */
+    int tile{-1};
+    /** Pyramid level index */
+    std::size_t level{0};
+    /** Optimizer iteration index within the level */
+    std::size_t iteration{0};
+    /** Metric value */
+    double metric{0};
+    /** Optimizer step length */
+    double stepLength{0};
+    /** L2 norm of the metric gradient */
+    double gradientNorm{0};
+    /** Time since the start of the level */
+    double elapsed{0};
+    /** Total time spent in this iteration */
+    double iterationTime{0};
+    /** Time spent evaluating the metric value and gradient this iteration */
+    double metricTime{0};
+    /** Time spent in the optimizer update and transform this iteration */
+    double updateTime{0};
+};
+
+/** @brief Callback which receives per-iteration optimizer statistics */
+using IterationObserver = std::function<void(const IterationInfo&)>;
+
+/** @brief Serialize an IterationInfo as a single-line JSON object */
+auto ToJSONLine(const IterationInfo& info) -> std::string;
+
+/**
+ * @brief Create an observer which appends records to a JSON-lines file
+ *
+ * The file is truncated when the observer is created. The returned observer
+ * and all of its copies share the same file handle and are safe to call from
+ * multiple threads.
+ *
+ * @throws std::runtime_error if the file cannot be opened
+ */
+auto MakeJSONLinesObserver(const filesystem::path& path) -> IterationObserver;
+
+}  // namespace rt
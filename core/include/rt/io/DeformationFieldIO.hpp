@@ -0,0 +1,19 @@
+#pragma once
+
+/** @file */
+
+#include "rt/ITKImageTypes.hpp"
+#include "rt/filesystem.hpp"
+
+namespace rt
+{
+
+/** @brief Write a DeformationField to a file (.dfm) */
+void WriteDeformationField(
+    const rt::filesystem::path& path, const DeformationField::Pointer& field);
+
+/** @brief Read a DeformationField from a file (.dfm) */
+auto ReadDeformationField(const rt::filesystem::path& path)
+    -> DeformationField::Pointer;
+
+}  // namespace rt
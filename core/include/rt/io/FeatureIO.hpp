@@ -0,0 +1,23 @@
+#pragma once
+
+/** @file */
+
+#include "rt/filesystem.hpp"
+#include "rt/types/Features.hpp"
+
+namespace rt
+{
+
+/**
+ * @brief Write ImageFeatures to a file (.feat)
+ *
+ * The file has a plain-text header followed by the key points and
+ * descriptors in native binary form.
+ */
+void WriteFeatures(
+    const rt::filesystem::path& path, const ImageFeatures& features);
+
+/** @brief Read ImageFeatures from a file (.feat) */
+auto ReadFeatures(const rt::filesystem::path& path) -> ImageFeatures;
+
+}  // namespace rt
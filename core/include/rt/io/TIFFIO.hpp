@@ -2,10 +2,18 @@
 
 /** @file */
 
+#include <vector>
+
 #include <opencv2/core.hpp>
 
 #include "rt/filesystem.hpp"
 
+// libtiff handle, declared in the same namespace as TIFFIO.cpp's include
+namespace lt
+{
+struct tiff;
+}
+
 namespace rt::io
 {
 
@@ -33,4 +41,65 @@ auto ReadRawTIFF(const filesystem::path& path, int offset = 0) -> cv::Mat;
  * you only need TIFF support, use rt::WriteImage instead.
  */
 void WriteTIFF(const filesystem::path& path, const cv::Mat& img);
-}  // namespace rt
+
+/**
+ * @brief Incremental TIFF writer
+ *
+ * Writes an image of a known size and type in row bands, from top to
+ * bottom, so that the full image never has to be held in memory. Rows are
+ * compressed and written to disk as each strip fills. Supports the same
+ * depths and channel counts as WriteTIFF.
+ *
+ * @code
+ * io::TIFFWriter writer(path, size, CV_16UC3);
+ * for (const auto& band : bands) {
+ *     writer.writeRows(band);
+ * }
+ * writer.close();
+ * @endcode
+ */
+class TIFFWriter
+{
+public:
+    /** @brief Open a file for writing an image of the given size and type */
+    TIFFWriter(const filesystem::path& path, const cv::Size& size, int type);
+
+    /** @brief Closes the file if close() has not been called */
+    ~TIFFWriter();
+
+    /** @brief Not copyable */
+    TIFFWriter(const TIFFWriter&) = delete;
+    /** @brief Not copyable */
+    auto operator=(const TIFFWriter&) -> TIFFWriter& = delete;
+
+    /**
+     * @brief Append the rows of a band to the image
+     *
+     * The band must have the image width and type.
+     */
+    void writeRows(const cv::Mat& rows);
+
+    /** @brief Number of rows written so far */
+    [[nodiscard]] auto rowsWritten() const -> int;
+
+    /**
+     * @brief Finish writing and close the file
+     *
+     * @throws std::runtime_error if fewer rows than the image height were
+     * written
+     */
+    void close();
+
+private:
+    /** Output file */
+    lt::tiff* out_{nullptr};
+    /** Image size */
+    cv::Size size_;
+    /** Image type */
+    int type_;
+    /** Next row to write */
+    int row_{0};
+    /** Scanline buffer */
+    std::vector<char> buffer_;
+};
+}  // namespace rt::io
@@ -0,0 +1,27 @@
+#pragma once
+
+/** @file */
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+namespace rt
+{
+
+/**
+ * @brief Key points and descriptors detected in an image
+ *
+ * Key points are in the coordinates of the image which was searched, which
+ * may have been downscaled from the original image by scale.
+ */
+struct ImageFeatures {
+    /** Key points */
+    std::vector<cv::KeyPoint> keyPoints;
+    /** Descriptors, one row per key point */
+    cv::Mat descriptors;
+    /** Scale of the searched image relative to the original image */
+    float scale{1.F};
+};
+
+}  // namespace rt
@@ -34,4 +34,19 @@ void WriteTransform(const filesystem::path& path, const T& transform)
 
 /** @brief Read Transform from a file */
 auto ReadTransform(const filesystem::path& path) -> Transform::Pointer;
+
+/**
+ * @brief Scale a transform for use with images resized by the same factor
+ *
+ * If transform maps fixed image pixels to moving image pixels, the result
+ * maps the pixels of a fixed image resized by scale to the pixels of a moving
+ * image resized by scale. Pixel centers are preserved, so pixel (0, 0) of the
+ * resized image covers the first 1/scale pixels of the original. Use this to
+ * resample a downscaled preview without resampling at full resolution first.
+ *
+ * @throws std::invalid_argument if the transform is null or scale is not
+ * positive
+ */
+auto ScaleTransform(const Transform::Pointer& transform, double scale)
+    -> Transform::Pointer;
 }  // namespace rt
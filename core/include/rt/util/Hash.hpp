@@ -0,0 +1,41 @@
+#pragma once
+
+/** @file */
+
+#include <cstdint>
+#include <string>
+
+#include <opencv2/core.hpp>
+
+namespace rt
+{
+
+/** @brief Initial value of a running hash (the FNV-1a offset basis) */
+constexpr std::uint64_t HASH_SEED{14695981039346656037ULL};
+
+/**
+ * @brief 64-bit FNV-1a hash of a byte buffer
+ *
+ * Continues from seed, which is the result of a previous hash or HASH_SEED.
+ * Not suitable for cryptographic use.
+ */
+auto HashBytes(
+    const void* data, std::size_t size, std::uint64_t seed = HASH_SEED)
+    -> std::uint64_t;
+
+/** @brief Combine a hash value into a running hash */
+auto HashCombine(std::uint64_t seed, std::uint64_t value) -> std::uint64_t;
+
+/**
+ * @brief Hash the contents of an image
+ *
+ * Includes the image's size and type, but not its memory layout, so a view
+ * and a continuous copy of the same pixels have the same hash. Rows are
+ * hashed in parallel.
+ */
+auto HashImage(const cv::Mat& img) -> std::uint64_t;
+
+/** @brief Format a hash value as a 16-digit hexadecimal string */
+auto HashToString(std::uint64_t hash) -> std::string;
+
+}  // namespace rt
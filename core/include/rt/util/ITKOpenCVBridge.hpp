@@ -23,6 +23,33 @@ auto ITKImageToCVMat(const itk::SmartPointer<ITKImageType>& img) -> cv::Mat;
  */
 template <typename ITKImageType>
 auto CVMatToITKImage(const cv::Mat& img) -> typename ITKImageType::Pointer;
+
+/**
+ * @brief Wrap a single-channel cv::Mat in an itk::Image without copying
+ *
+ * The returned image shares its pixel buffer with the input and holds a
+ * reference to it, so the cv::Mat data remains valid for the lifetime of the
+ * returned image. Modifications to either image are visible in the other.
+ *
+ * @throws std::invalid_argument if the input is empty, not continuous, not
+ * single-channel, or its depth does not match the ITK pixel type
+ */
+template <typename ITKImageType>
+auto CVMatToITKImageView(const cv::Mat& img) -> typename ITKImageType::Pointer;
+
+/**
+ * @brief Wrap an itk::Image in a cv::Mat without copying
+ *
+ * The returned cv::Mat is only a header over the ITK pixel buffer. It does
+ * not extend the lifetime of the input image. The caller must keep the
+ * input alive for as long as the result is used. Multi-channel images are
+ * not swizzled, so they keep ITK's RGB(A) channel order.
+ *
+ * @throws std::invalid_argument if the image is null
+ */
+template <typename ITKImageType>
+auto ITKImageToCVMatView(const itk::SmartPointer<ITKImageType>& img)
+    -> cv::Mat;
 }  // namespace rt
 
 #include "ITKOpenCVBridgeImpl.hpp"
\ No newline at end of file
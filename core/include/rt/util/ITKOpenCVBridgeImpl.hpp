@@ -1,7 +1,8 @@
 #include <exception>
+#include <type_traits>
 #include <typeinfo>
 
-#include <itkConvertPixelBuffer.h>
+#include <itkImportImageContainer.h>
 #include <itkNumericTraits.h>
 #include <itkRGBAPixel.h>
 #include <itkRGBPixel.h>
@@ -14,15 +15,91 @@ namespace rt
 
 namespace detail
 {
+/** Import container which keeps a cv::Mat alive while ITK uses its buffer */
+template <typename TElement>
+class CVMatImportContainer
+    : public itk::ImportImageContainer<itk::SizeValueType, TElement>
+{
+public:
+    using Self = CVMatImportContainer;
+    using Superclass = itk::ImportImageContainer<itk::SizeValueType, TElement>;
+    using Pointer = itk::SmartPointer<Self>;
+    using ConstPointer = itk::SmartPointer<const Self>;
+
+    itkNewMacro(Self);
+    itkTypeMacro(CVMatImportContainer, ImportImageContainer);
+
+    /** Share the buffer of a continuous cv::Mat */
+    void setMat(const cv::Mat& m)
+    {
+        mat_ = m;
+        auto elements = mat_.total() * mat_.elemSize() / sizeof(TElement);
+        this->SetImportPointer(
+            reinterpret_cast<TElement*>(mat_.data),
+            static_cast<itk::SizeValueType>(elements), false);
+    }
+
+protected:
+    CVMatImportContainer() = default;
+    ~CVMatImportContainer() override = default;
+
+private:
+    cv::Mat mat_;
+};
+
+/** Create an unallocated image with the default geometry and given size */
+template <typename ITKImageType>
+auto NewImage(int w, int h) -> typename ITKImageType::Pointer
+{
+    typename ITKImageType::RegionType region;
+    typename ITKImageType::RegionType::SizeType size;
+    typename ITKImageType::RegionType::IndexType start;
+    typename ITKImageType::SpacingType spacing;
+    size.Fill(1);
+    size[0] = w;
+    size[1] = h;
+    start.Fill(0);
+    spacing.Fill(1);
+    region.SetSize(size);
+    region.SetIndex(start);
+
+    auto out = ITKImageType::New();
+    out->SetRegions(region);
+    out->SetSpacing(spacing);
+    return out;
+}
+
+/** Get the cv::Mat type which matches an ITK pixel type */
+template <typename PixelType>
+auto CVMatType() -> int
+{
+    using ValueType = typename itk::NumericTraits<PixelType>::ValueType;
+    auto cns = itk::NumericTraits<PixelType>::MeasurementVectorType::Dimension;
+    if (typeid(ValueType) == typeid(uint8_t)) {
+        return CV_8UC(cns);
+    } else if (typeid(ValueType) == typeid(int8_t)) {
+        return CV_8SC(cns);
+    } else if (typeid(ValueType) == typeid(uint16_t)) {
+        return CV_16UC(cns);
+    } else if (typeid(ValueType) == typeid(int16_t)) {
+        return CV_16SC(cns);
+    } else if (typeid(ValueType) == typeid(float)) {
+        return CV_32FC(cns);
+    } else if (typeid(ValueType) == typeid(int32_t)) {
+        return CV_32SC(cns);
+    } else if (typeid(ValueType) == typeid(double)) {
+        return CV_64FC(cns);
+    } else {
+        throw std::invalid_argument("Unrecognized pixel type");
+    }
+}
+
 /** Convert a cv::Mat to an itk::Image with a specific pixel type */
 template <typename ITKImageType, typename CVPixelType>
 auto CVMatToITKImage(const cv::Mat& img) -> typename ITKImageType::Pointer
 {
     // Typedefs
     using ITKPixelType = typename ITKImageType::PixelType;
-    using ConvertPixelTraits = itk::DefaultConvertPixelTraits<ITKPixelType>;
-    using ConvertBuffer =
-        itk::ConvertPixelBuffer<CVPixelType, ITKPixelType, ConvertPixelTraits>;
 
     // Dimensions
     auto w = img.cols;
@@ -47,82 +124,53 @@ auto CVMatToITKImage(const cv::Mat& img) -> typename ITKImageType::Pointer
             "Unsupported channels: " + std::to_string(cns));
     }
 
-    typename ITKImageType::RegionType region;
-    typename ITKImageType::RegionType::SizeType size;
-    typename ITKImageType::RegionType::IndexType start;
-    typename ITKImageType::SpacingType spacing;
-    size.Fill(1);
-    size[0] = w;
-    size[1] = h;
-    start.Fill(0);
-    spacing.Fill(1);
-    region.SetSize(size);
-    region.SetIndex(start);
+    auto out = NewImage<ITKImageType>(w, h);
+    out->Allocate();
 
-    // BGR -> RGB
-    cv::Mat tmp;
-    if (img.channels() == 4) {
-        cv::cvtColor(img, tmp, cv::COLOR_BGRA2RGBA);
-    } else if (img.channels() == 3) {
-        cv::cvtColor(img, tmp, cv::COLOR_BGR2RGB);
+    // Write directly into the ITK buffer, swapping BGR -> RGB on the way
+    cv::Mat dst(h, w, img.type(), out->GetBufferPointer());
+    if (cns == 4) {
+        cv::cvtColor(img, dst, cv::COLOR_BGRA2RGBA);
+    } else if (cns == 3) {
+        cv::cvtColor(img, dst, cv::COLOR_BGR2RGB);
     } else {
-        tmp = img;
+        img.copyTo(dst);
     }
 
-    auto out = ITKImageType::New();
-    out->SetRegions(region);
-    out->SetSpacing(spacing);
-    out->Allocate();
-
-    ConvertBuffer::Convert(
-        reinterpret_cast<CVPixelType*>(tmp.data), cns,
-        out->GetPixelContainer()->GetBufferPointer(),
-        out->GetPixelContainer()->Size());
-
     return out;
 }
 }  // namespace detail
 
 template <typename ITKImageType>
-auto ITKImageToCVMat(const itk::SmartPointer<ITKImageType>& img) -> cv::Mat
+auto ITKImageToCVMatView(const itk::SmartPointer<ITKImageType>& img)
+    -> cv::Mat
 {
-
     using PixelType = typename ITKImageType::PixelType;
-    using ValueType = typename itk::NumericTraits<PixelType>::ValueType;
 
     // Make sure the image is not null
     if (!img) {
         throw std::invalid_argument("img is nullptr");
     }
 
-    // Get the channels and dimensions
-    auto region = img->GetLargestPossibleRegion();
-    auto size = region.GetSize();
-    auto cns = itk::NumericTraits<PixelType>::MeasurementVectorType::Dimension;
+    auto size = img->GetLargestPossibleRegion().GetSize();
     auto w = static_cast<int>(size[0]);
     auto h = static_cast<int>(size[1]);
+    auto type = detail::CVMatType<PixelType>();
+    return cv::Mat(
+        h, w, type, reinterpret_cast<uint8_t*>(img->GetBufferPointer()));
+}
 
-    // Get the pixel type depth
-    int type{-1};
-    if (typeid(ValueType) == typeid(uint8_t)) {
-        type = CV_8UC(cns);
-    } else if (typeid(ValueType) == typeid(int8_t)) {
-        type = CV_8SC(cns);
-    } else if (typeid(ValueType) == typeid(uint16_t)) {
-        type = CV_16UC(cns);
-    } else if (typeid(ValueType) == typeid(int16_t)) {
-        type = CV_16SC(cns);
-    } else if (typeid(ValueType) == typeid(float)) {
-        type = CV_32FC(cns);
-    } else if (typeid(ValueType) == typeid(int32_t)) {
-        type = CV_32SC(cns);
-    } else if (typeid(ValueType) == typeid(double)) {
-        type = CV_64FC(cns);
-    } else {
-        throw std::invalid_argument("Unrecognized pixel type");
+template <typename ITKImageType>
+auto ITKImageToCVMat(const itk::SmartPointer<ITKImageType>& img) -> cv::Mat
+{
+    // Make sure the image is not null
+    if (!img) {
+        throw std::invalid_argument("img is nullptr");
     }
-    auto tmp = cv::Mat(
-        h, w, type, reinterpret_cast<uint8_t*>(img->GetBufferPointer()));
+
+    // Wrap the ITK buffer
+    auto tmp = ITKImageToCVMatView(img);
+    auto cns = tmp.channels();
 
     // RGB -> BGR if needed
     cv::Mat out;
@@ -167,4 +215,34 @@ auto CVMatToITKImage(const cv::Mat& img) -> typename ITKImageType::Pointer
             throw std::invalid_argument("Image type not supported");
     }
 }
+
+template <typename ITKImageType>
+auto CVMatToITKImageView(const cv::Mat& img) -> typename ITKImageType::Pointer
+{
+    using ITKPixelType = typename ITKImageType::PixelType;
+    static_assert(
+        std::is_arithmetic<ITKPixelType>::value,
+        "Image views require a scalar pixel type");
+
+    if (img.empty()) {
+        throw std::invalid_argument("Empty image");
+    }
+    if (img.channels() != 1) {
+        throw std::invalid_argument(
+            "Unsupported channels: " + std::to_string(img.channels()));
+    }
+    if (not img.isContinuous()) {
+        throw std::invalid_argument("Image is not continuous");
+    }
+    if (img.type() != detail::CVMatType<ITKPixelType>()) {
+        throw std::invalid_argument("Image depths don't match");
+    }
+
+    auto container = detail::CVMatImportContainer<ITKPixelType>::New();
+    container->setMat(img);
+
+    auto out = detail::NewImage<ITKImageType>(img.cols, img.rows);
+    out->SetPixelContainer(container);
+    return out;
+}
 }  // namespace rt
\ No newline at end of file
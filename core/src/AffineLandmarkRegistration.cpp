@@ -1,5 +1,7 @@
 #include "rt/AffineLandmarkRegistration.hpp"
 
+#include <chrono>
+
 #include <itkLandmarkBasedTransformInitializer.h>
 
 #include "rt/ITKImageTypes.hpp"
@@ -13,12 +15,19 @@ void AffineLandmarkRegistration::setReportMetrics(bool i)
 
 bool AffineLandmarkRegistration::getReportMetrics() { return reportMetrics_; }
 
+void AffineLandmarkRegistration::setIterationObserver(IterationObserver o)
+{
+    observer_ = std::move(o);
+}
+
 auto AffineLandmarkRegistration::compute()
     -> AffineLandmarkRegistration::Transform::Pointer
 {
     using TransformInitializer =
         itk::LandmarkBasedTransformInitializer<Transform, Image8UC3, Image8UC3>;
 
+    auto start = std::chrono::steady_clock::now();
+
     // Setup new transform
     output_ = Transform::New();
 
@@ -34,6 +43,18 @@ auto AffineLandmarkRegistration::compute()
         std::cout << "Affine Metric: " << output_->Metric() << std::endl;
     }
 
+    if (observer_) {
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        IterationInfo info;
+        info.stage = "affine";
+        info.metric = output_->Metric();
+        info.elapsed = elapsed.count();
+        info.iterationTime = elapsed.count();
+        info.updateTime = elapsed.count();
+        observer_(info);
+    }
+
     return output_;
 }
 
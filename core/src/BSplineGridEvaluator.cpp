@@ -0,0 +1,128 @@
+#include "rt/BSplineGridEvaluator.hpp"
+
+#include <cmath>
+
+#include <itkMath.h>
+
+using namespace rt;
+
+// Whether the coefficient grid is axis-aligned
+static auto IsAxisAligned(const BSplineGridEvaluator::Transform* transform)
+    -> bool
+{
+    auto dir = transform->GetCoefficientImages()[0]->GetDirection();
+    return dir(0, 1) == 0 and dir(1, 0) == 0;
+}
+
+BSplineGridEvaluator::BSplineGridEvaluator(
+    const Transform* transform, int width)
+    : width_{width}
+{
+    if (transform == nullptr) {
+        throw std::invalid_argument("transform is null");
+    }
+    if (not IsAxisAligned(transform)) {
+        throw std::invalid_argument("B-spline grid is not axis-aligned");
+    }
+
+    const auto& images = transform->GetCoefficientImages();
+    auto size = images[0]->GetLargestPossibleRegion().GetSize();
+    auto origin = images[0]->GetOrigin();
+    auto spacing = images[0]->GetSpacing();
+    auto dir = images[0]->GetDirection();
+    for (unsigned d = 0; d < 2; d++) {
+        size_[d] = size[d];
+        origin_[d] = origin[d];
+        scale_[d] = 1. / (spacing[d] * dir(d, d));
+    }
+
+    // Copy the coefficients so that the transform can change afterwards
+    auto count = size_[0] * size_[1];
+    for (unsigned d = 0; d < 2; d++) {
+        const auto* buffer = images[d]->GetBufferPointer();
+        coeffs_[d].assign(buffer, buffer + count);
+    }
+
+    // Column supports are shared by every row
+    columns_.resize(width_);
+    for (int x = 0; x < width_; x++) {
+        columns_[x] = GetSupport((x - origin_[0]) * scale_[0], size_[0]);
+    }
+}
+
+auto BSplineGridEvaluator::IsSupported(const Transform* transform) -> bool
+{
+    return transform != nullptr and IsAxisAligned(transform);
+}
+
+auto BSplineGridEvaluator::width() const -> int { return width_; }
+
+// Matches itk::BSplineTransform::InsideValidRegion and
+// itk::BSplineInterpolationWeightFunction for a cubic spline
+auto BSplineGridEvaluator::GetSupport(double index, std::size_t size)
+    -> Support
+{
+    Support s;
+    const auto minLimit = 1.;
+    const auto maxLimit = static_cast<double>(size) - 2.;
+    if (itk::Math::FloatAlmostEqual(index, maxLimit, 4)) {
+        index = itk::Math::FloatAddULP(maxLimit, -6);
+    } else if (index >= maxLimit or index < minLimit) {
+        return s;
+    }
+
+    auto floor = std::floor(index);
+    auto t = index - floor;
+    auto u = 1. - t;
+    auto t2 = t * t;
+    auto t3 = t2 * t;
+    s.inside = true;
+    s.start = static_cast<int>(floor) - 1;
+    s.weights[0] = u * u * u / 6.;
+    s.weights[1] = (3. * t3 - 6. * t2 + 4.) / 6.;
+    s.weights[2] = (-3. * t3 + 3. * t2 + 3. * t + 1.) / 6.;
+    s.weights[3] = t3 / 6.;
+    return s;
+}
+
+void BSplineGridEvaluator::evaluateRow(int y, cv::Point2d* out) const
+{
+    // Points outside of the valid region are not transformed
+    auto row = GetSupport((y - origin_[1]) * scale_[1], size_[1]);
+    if (not row.inside) {
+        for (int x = 0; x < width_; x++) {
+            out[x] = {static_cast<double>(x), static_cast<double>(y)};
+        }
+        return;
+    }
+
+    // Blend the four control point rows which support this row
+    auto gridW = size_[0];
+    std::array<std::vector<double>, 2> blended;
+    for (unsigned d = 0; d < 2; d++) {
+        blended[d].assign(gridW, 0.);
+        for (int j = 0; j < 4; j++) {
+            auto w = row.weights[j];
+            const auto* c = coeffs_[d].data() + (row.start + j) * gridW;
+            auto* b = blended[d].data();
+            for (std::size_t g = 0; g < gridW; g++) {
+                b[g] += w * c[g];
+            }
+        }
+    }
+
+    // Interpolate each pixel from four blended values
+    const auto* bx = blended[0].data();
+    const auto* by = blended[1].data();
+    for (int x = 0; x < width_; x++) {
+        const auto& col = columns_[x];
+        cv::Point2d p{static_cast<double>(x), static_cast<double>(y)};
+        if (col.inside) {
+            for (int i = 0; i < 4; i++) {
+                p.x += col.weights[i] * bx[col.start + i];
+                p.y += col.weights[i] * by[col.start + i];
+            }
+        }
+        out[x] = p;
+    }
+}
@@ -3,7 +3,6 @@
 #include <itkLandmarkBasedTransformInitializer.h>
 
 #include "rt/ITKImageTypes.hpp"
-#include "rt/util/ITKOpenCVBridge.hpp"
 
 using namespace rt;
 
@@ -17,9 +16,15 @@ auto BSplineLandmarkWarping::compute()
         throw std::invalid_argument("Empty input parameter");
     }
 
-    // Convert to 8UC3
-    auto fixed8u = QuantizeImage(fixedImg_, CV_8U);
-    auto fixedImg = CVMatToITKImage<Image8UC3>(fixed8u);
+    // The initializer only uses the geometry of the reference image, so
+    // don't allocate or copy any pixel data
+    Image8UC3::RegionType region;
+    Image8UC3::SizeType size;
+    size[0] = fixedImg_.cols;
+    size[1] = fixedImg_.rows;
+    region.SetSize(size);
+    auto fixedImg = Image8UC3::New();
+    fixedImg->SetRegions(region);
 
     using TransformInitializer =
         itk::LandmarkBasedTransformInitializer<Transform, Image8UC3, Image8UC3>;
@@ -1,77 +1,734 @@
 #include "rt/DeformableRegistration.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <random>
+#include <tuple>
+
+#include <itkBSplineScatteredDataPointSetToImageFilter.h>
+#include <itkBSplineTransformParametersAdaptor.h>
 #include <itkCommand.h>
+#include <itkImageMaskSpatialObject.h>
 #include <itkImageRegistrationMethod.h>
+#include <itkImageRegistrationMethodv4.h>
 #include <itkLinearInterpolateImageFunction.h>
 #include <itkMattesMutualInformationImageToImageMetric.h>
+#include <itkMattesMutualInformationImageToImageMetricv4.h>
+#include <itkPointSet.h>
 #include <itkRegularStepGradientDescentOptimizer.h>
+#include <itkRegularStepGradientDescentOptimizerv4.h>
+#include <itkVectorIndexSelectionCastImageFilter.h>
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgproc.hpp>
 
 #include "rt/ITKImageTypes.hpp"
 #include "rt/util/ITKOpenCVBridge.hpp"
+#include "rt/util/ImageConversion.hpp"
 
 using namespace rt;
 
-using GrayInterpolator =
-    itk::LinearInterpolateImageFunction<Image8UC1, double>;
-using Metric =
-    itk::MattesMutualInformationImageToImageMetric<Image8UC1, Image8UC1>;
+template <class TImage>
+using GrayInterpolator = itk::LinearInterpolateImageFunction<TImage, double>;
+template <class TImage>
+using Metric = itk::MattesMutualInformationImageToImageMetric<TImage, TImage>;
 using Optimizer = itk::RegularStepGradientDescentOptimizer;
-using Registration = itk::ImageRegistrationMethod<Image8UC1, Image8UC1>;
+template <class TImage>
+using Registration = itk::ImageRegistrationMethod<TImage, TImage>;
+template <class TImage>
+using MetricV4 =
+    itk::MattesMutualInformationImageToImageMetricv4<TImage, TImage>;
+using OptimizerV4 = itk::RegularStepGradientDescentOptimizerv4<double>;
+template <class TImage>
+using RegistrationV4 = itk::ImageRegistrationMethodv4<
+    TImage,
+    TImage,
+    DeformableRegistration::Transform>;
 using BSplineParameters = DeformableRegistration::Transform::ParametersType;
+using MaskSpatialObject = itk::ImageMaskSpatialObject<2>;
+using BSplineAdaptor =
+    itk::BSplineTransformParametersAdaptor<DeformableRegistration::Transform>;
+using DisplacementPointSet = itk::PointSet<Vector, 2>;
+using BSplineFitter = itk::BSplineScatteredDataPointSetToImageFilter<
+    DisplacementPointSet,
+    DeformationField>;
+using CoefficientSelector = itk::VectorIndexSelectionCastImageFilter<
+    DeformationField,
+    DeformableRegistration::Transform::ImageType>;
 
 static constexpr double DEFAULT_MAX_STEP_FACTOR = 1.0 / 500.0;
 static constexpr double DEFAULT_MIN_STEP_FACTOR = 1.0 / 500000.0;
 
-/* The metric requires two parameters to be selected: the number
-of bins used to compute the entropy and the number of spatial samples
-used to compute the density estimates. In typical application, 50
-histogram bins are sufficient and the metric is relatively insensitive
-to changes in the number of bins. The number of spatial samples
-to be used depends on the content of the image. If the images are
-smooth and do not contain much detail, then using approximately
-1 percent of the pixels will do. On the other hand, if the images
-are detailed, it may be necessary to use a much higher proportion,
-such as 20 percent. */
-static constexpr size_t DEFAULT_HISTOGRAM_BINS = 50;
-static constexpr double DEFAULT_SAMPLE_FACTOR = 1.0 / 80.0;
-
 using Transform = DeformableRegistration::Transform;
 
-class ReportMetricCallback : public itk::Command
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+// Seconds between two time points
+auto Seconds(const Clock::time_point& a, const Clock::time_point& b) -> double
+{
+    return std::chrono::duration<double>(b - a).count();
+}
+
+// Write a transform to a temporary file and move it into place, so readers
+// never see a partially written file
+void WriteTransformAtomic(
+    const filesystem::path& path,
+    const DeformableRegistration::Transform::Pointer& tfm)
+{
+    auto tmp = path.parent_path() /
+               (path.stem().string() + ".tmp" + path.extension().string());
+    WriteTransform(tmp, tfm);
+    filesystem::rename(tmp, path);
+}
+
+// Reports optimizer progress to the console and/or an iteration observer.
+// Also enforces the time budget and writes checkpoints.
+template <class TOptimizer>
+class IterationCallback : public itk::Command
 {
 protected:
-    ReportMetricCallback() = default;
+    IterationCallback() = default;
 
 public:
-    using Pointer = itk::SmartPointer<ReportMetricCallback>;
-    using Optimizer = itk::RegularStepGradientDescentOptimizer;
+    using Pointer = itk::SmartPointer<IterationCallback>;
+    using Optimizer = TOptimizer;
+    using Parameters = DeformableRegistration::Transform::ParametersType;
 
     static auto New() -> Pointer
     {
-        Pointer smartPtr = ::itk::ObjectFactory<ReportMetricCallback>::Create();
+        Pointer smartPtr = ::itk::ObjectFactory<IterationCallback>::Create();
         if (smartPtr == nullptr) {
-            smartPtr = new ReportMetricCallback;
+            smartPtr = new IterationCallback;
         }
         smartPtr->UnRegister();
         return smartPtr;
     }
 
+    /** Optimizer being observed */
+    Optimizer* optimizer{nullptr};
+    /** Transform being optimized */
+    DeformableRegistration::Transform::Pointer transform;
+    /** Print the metric value to the console */
+    bool reportMetrics{false};
+    /** Observer which receives the iteration statistics */
+    IterationObserver observer;
+    /** Template record with the stage, tile, and level filled in */
+    IterationInfo info;
+    /** Returns the total time spent evaluating the metric */
+    std::function<double()> metricTime;
+    /** Stop the optimizer once this time is reached */
+    Clock::time_point deadline{Clock::time_point::max()};
+    /** Checkpoint file. Checkpoints are disabled if empty. */
+    filesystem::path checkpointPath;
+    /** Minimum time between checkpoints, in seconds */
+    double checkpointInterval{0};
+
+    /** Start timing */
+    void start()
+    {
+        start_ = last_ = lastCheckpoint_ = Clock::now();
+        lastMetricTime_ = 0;
+        stopped_ = false;
+        prev_ = best_ = transform->GetParameters();
+        bestValue_ = std::numeric_limits<double>::infinity();
+    }
+
+    /**
+     * Get the parameters for the end of the level. If the optimizer was
+     * stopped by the time budget, these are the best parameters evaluated so
+     * far. Otherwise, the final parameters are returned unchanged.
+     */
+    auto result(const Parameters& final) const -> Parameters
+    {
+        return stopped_ and std::isfinite(bestValue_) ? best_ : final;
+    }
+
     void Execute(itk::Object* caller, const itk::EventObject& event) override
     {
         Execute(reinterpret_cast<const itk::Object*>(caller), event);
     }
 
-    void Execute(
-        const itk::Object* object, const itk::EventObject& event) override
+    void Execute(const itk::Object*, const itk::EventObject& event) override
     {
-        const auto* optimizer = dynamic_cast<const Optimizer*>(object);
         if (not itk::IterationEvent().CheckEvent(&event)) {
             return;
         }
-        std::cout << optimizer->GetValue() << std::endl;
+        if (reportMetrics) {
+            std::cout << optimizer->GetValue() << std::endl;
+        }
+
+        // The reported value belongs to the parameters from before this
+        // iteration's step
+        auto now = Clock::now();
+        auto tracking = deadline != Clock::time_point::max() or
+                        not checkpointPath.empty();
+        if (tracking) {
+            if (optimizer->GetValue() < bestValue_) {
+                bestValue_ = optimizer->GetValue();
+                best_ = prev_;
+            }
+            prev_ = optimizer->GetCurrentPosition();
+        }
+
+        if (observer) {
+            auto mt = metricTime ? metricTime() : 0.0;
+            auto i = info;
+            i.iteration = optimizer->GetCurrentIteration();
+            i.metric = optimizer->GetValue();
+            i.stepLength = optimizer->GetCurrentStepLength();
+            i.gradientNorm = optimizer->GetGradient().two_norm();
+            i.elapsed = Seconds(start_, now);
+            i.iterationTime = Seconds(last_, now);
+            i.metricTime = mt - lastMetricTime_;
+            i.updateTime = std::max(0.0, i.iterationTime - i.metricTime);
+            observer(i);
+            lastMetricTime_ = mt;
+        }
+        last_ = now;
+
+        // Periodically save the best transform so far
+        if (not checkpointPath.empty() and
+            Seconds(lastCheckpoint_, now) >= checkpointInterval) {
+            auto tfm = DeformableRegistration::Transform::New();
+            tfm->SetFixedParameters(transform->GetFixedParameters());
+            tfm->SetParametersByValue(best_);
+            WriteTransformAtomic(checkpointPath, tfm);
+            lastCheckpoint_ = now;
+        }
+
+        // Out of time
+        if (now >= deadline) {
+            stopped_ = true;
+            optimizer->StopOptimization();
+        }
+    }
+
+private:
+    /** Level start time */
+    Clock::time_point start_;
+    /** Previous iteration time */
+    Clock::time_point last_;
+    /** Previous checkpoint time */
+    Clock::time_point lastCheckpoint_;
+    /** Metric time at the previous iteration */
+    double lastMetricTime_{0};
+    /** Whether the optimizer was stopped by the time budget */
+    bool stopped_{false};
+    /** Parameters before the most recent step */
+    Parameters prev_;
+    /** Best parameters so far */
+    Parameters best_;
+    /** Metric value of the best parameters */
+    double bestValue_{0};
+};
+
+// Mattes metric which accumulates the time spent evaluating the metric
+template <class TImage>
+class TimedMetric : public Metric<TImage>
+{
+public:
+    using Self = TimedMetric;
+    using Superclass = Metric<TImage>;
+    using Pointer = itk::SmartPointer<Self>;
+    using ConstPointer = itk::SmartPointer<const Self>;
+    itkNewMacro(Self);
+
+    void GetValueAndDerivative(
+        const typename Superclass::ParametersType& parameters,
+        typename Superclass::MeasureType& value,
+        typename Superclass::DerivativeType& derivative) const override
+    {
+        auto t0 = Clock::now();
+        Superclass::GetValueAndDerivative(parameters, value, derivative);
+        elapsed_ += Seconds(t0, Clock::now());
+    }
+
+    /** Total time spent in GetValueAndDerivative */
+    auto elapsed() const -> double { return elapsed_; }
+
+protected:
+    TimedMetric() = default;
+    ~TimedMetric() override = default;
+
+private:
+    mutable double elapsed_{0};
+};
+
+// v4 Mattes metric which accumulates the time spent evaluating the metric
+template <class TImage>
+class TimedMetricV4 : public MetricV4<TImage>
+{
+public:
+    using Self = TimedMetricV4;
+    using Superclass = MetricV4<TImage>;
+    using Pointer = itk::SmartPointer<Self>;
+    using ConstPointer = itk::SmartPointer<const Self>;
+    itkNewMacro(Self);
+
+    void GetValueAndDerivative(
+        typename Superclass::MeasureType& value,
+        typename Superclass::DerivativeType& derivative) const override
+    {
+        auto t0 = Clock::now();
+        Superclass::GetValueAndDerivative(value, derivative);
+        elapsed_ += Seconds(t0, Clock::now());
+    }
+
+    /** Total time spent in GetValueAndDerivative */
+    auto elapsed() const -> double { return elapsed_; }
+
+protected:
+    TimedMetricV4() = default;
+    ~TimedMetricV4() override = default;
+
+private:
+    mutable double elapsed_{0};
+};
+
+// Import a grayscale image into ITK, sharing its buffer when possible
+template <class TImage>
+auto ImportImage(const cv::Mat& img) -> typename TImage::Pointer
+{
+    if (img.isContinuous()) {
+        return CVMatToITKImageView<TImage>(img);
+    }
+    return CVMatToITKImage<TImage>(img);
+}
+
+// Shrink an image by the given factor
+auto ShrinkMat(const cv::Mat& img, unsigned factor) -> cv::Mat
+{
+    if (factor == 1 or img.empty()) {
+        return img;
+    }
+
+    auto f = static_cast<double>(factor);
+    cv::Size size{
+        std::max(1, static_cast<int>(std::round(img.cols / f))),
+        std::max(1, static_cast<int>(std::round(img.rows / f)))};
+    cv::Mat small;
+    cv::resize(img, small, size, 0, 0, cv::INTER_AREA);
+    return small;
+}
+
+// Convert a shrunken grayscale image to an ITK image. The spacing and origin
+// of the result are set so that it occupies the same physical space as the
+// full-resolution image.
+template <class TImage>
+auto ImportShrunkImage(const cv::Mat& small, const cv::Size& fullSize) ->
+    typename TImage::Pointer
+{
+    auto out = ImportImage<TImage>(small);
+    if (small.size() == fullSize) {
+        return out;
+    }
+
+    // Each shrunken pixel covers a block of full-resolution pixels
+    typename TImage::SpacingType spacing;
+    spacing[0] = static_cast<double>(fullSize.width) / small.cols;
+    spacing[1] = static_cast<double>(fullSize.height) / small.rows;
+    typename TImage::PointType origin;
+    origin[0] = (spacing[0] - 1.0) / 2.0;
+    origin[1] = (spacing[1] - 1.0) / 2.0;
+    out->SetSpacing(spacing);
+    out->SetOrigin(origin);
+    return out;
+}
+
+// Normalize a mask to a single-channel, 8-bit binary image
+auto BinarizeMask(const cv::Mat& mask, const cv::Size& imgSize) -> cv::Mat
+{
+    if (mask.empty()) {
+        return {};
+    }
+    if (mask.size() != imgSize) {
+        throw std::invalid_argument("Mask and image sizes do not match");
+    }
+    return ColorConvertImage(mask, 1) != 0;
+}
+
+// Shrink a binary mask. Shrunken pixels which overlap the foreground at all
+// are considered foreground.
+auto ShrinkMask(const cv::Mat& mask, unsigned factor) -> cv::Mat
+{
+    if (mask.empty() or factor == 1) {
+        return mask;
+    }
+    return ShrinkMat(mask, factor) != 0;
+}
+
+// Convert a shrunken binary mask to a spatial object
+auto ImportMask(const cv::Mat& mask, const cv::Size& fullSize)
+    -> MaskSpatialObject::Pointer
+{
+    if (mask.empty()) {
+        return nullptr;
+    }
+
+    auto so = MaskSpatialObject::New();
+    so->SetImage(ImportShrunkImage<Image8UC1>(mask, fullSize));
+#if ITK_VERSION_MAJOR >= 5
+    so->Update();
+#endif
+    return so;
+}
+
+// Generate metric sample positions for an image of the given size. Only
+// positions inside the (optional) mask are returned. Positions are always
+// returned in row-major order so that the metric walks memory sequentially.
+auto SamplePositions(
+    const cv::Size& size,
+    const cv::Mat& mask,
+    DeformableRegistration::Sampling strategy,
+    double percentage,
+    std::mt19937& rng) -> std::vector<cv::Point>
+{
+    using Sampling = DeformableRegistration::Sampling;
+    auto inMask = [&mask](int x, int y) {
+        return mask.empty() or mask.at<uint8_t>(y, x) != 0;
+    };
+
+    std::vector<cv::Point> pos;
+    pos.reserve(static_cast<size_t>(size.area() * percentage) + 1);
+
+    // Every pixel is independently selected with the sampling probability.
+    // Gaps between selected pixels are geometrically distributed, so we
+    // only visit the selected pixels.
+    if (strategy == Sampling::Random) {
+        if (percentage >= 1.0) {
+            strategy = Sampling::Regular;
+        } else {
+            std::geometric_distribution<int64_t> gap(percentage);
+            auto total = static_cast<int64_t>(size.area());
+            for (auto i = gap(rng); i < total; i += gap(rng) + 1) {
+                auto x = static_cast<int>(i % size.width);
+                auto y = static_cast<int>(i / size.width);
+                if (inMask(x, y)) {
+                    pos.emplace_back(x, y);
+                }
+            }
+            return pos;
+        }
+    }
+
+    // Regular grid with one sample per cell. Stratified sampling picks a
+    // random position in each cell.
+    auto step = std::max(1.0, 1.0 / std::sqrt(percentage));
+    auto rows = static_cast<int>(std::ceil(size.height / step));
+    auto cols = static_cast<int>(std::ceil(size.width / step));
+    std::uniform_real_distribution<double> jitter(0.0, step);
+    for (int r = 0; r < rows; r++) {
+        // Draw the whole row before sorting to keep row order
+        auto rowStart = pos.size();
+        for (int c = 0; c < cols; c++) {
+            double fx{0};
+            double fy{0};
+            if (strategy == Sampling::Stratified) {
+                fx = jitter(rng);
+                fy = jitter(rng);
+            }
+            auto x = static_cast<int>(c * step + fx);
+            auto y = static_cast<int>(r * step + fy);
+            if (x >= size.width or y >= size.height or not inMask(x, y)) {
+                continue;
+            }
+            pos.emplace_back(x, y);
+        }
+        if (strategy == Sampling::Stratified) {
+            std::sort(
+                pos.begin() + rowStart, pos.end(),
+                [](const cv::Point& a, const cv::Point& b) {
+                    return std::tie(a.y, a.x) < std::tie(b.y, b.x);
+                });
+        }
     }
+    return pos;
+}
+
+// Make an independent copy of a B-Spline transform
+auto CopyTransform(const DeformableRegistration::Transform* t)
+    -> DeformableRegistration::Transform::Pointer
+{
+    auto out = DeformableRegistration::Transform::New();
+    out->SetFixedParameters(t->GetFixedParameters());
+    out->SetParametersByValue(t->GetParameters());
+    return out;
+}
+
+// Copy a B-Spline transform into the coordinate frame of a tile whose
+// top-left corner is at the given offset
+auto TileTransform(
+    const DeformableRegistration::Transform::Pointer& t,
+    const cv::Point& offset) -> DeformableRegistration::Transform::Pointer
+{
+    // Fixed parameters are ordered: grid size, grid origin, grid spacing,
+    // grid direction
+    constexpr auto Dim = DeformableRegistration::Transform::SpaceDimension;
+    auto fixedParams = t->GetFixedParameters();
+    fixedParams[Dim] -= offset.x;
+    fixedParams[Dim + 1] -= offset.y;
+
+    auto out = DeformableRegistration::Transform::New();
+    out->SetFixedParameters(fixedParams);
+    out->SetParametersByValue(t->GetParameters());
+    return out;
+}
+
+// Find every B-Spline transform in a (possibly nested) transform
+void FindBSplineTransforms(
+    const rt::Transform* t,
+    std::vector<const DeformableRegistration::Transform*>& found)
+{
+    if (const auto* b =
+            dynamic_cast<const DeformableRegistration::Transform*>(t)) {
+        found.push_back(b);
+    } else if (const auto* c = dynamic_cast<const CompositeTransform*>(t)) {
+        for (unsigned i = 0; i < c->GetNumberOfTransforms(); i++) {
+            FindBSplineTransforms(c->GetNthTransformConstPointer(i), found);
+        }
+    }
+}
+
+// Sample positions along a tile axis, always including the last position
+auto TileSamplePositions(int length, int step) -> std::vector<int>
+{
+    std::vector<int> pos;
+    for (int i = 0; i < length - 1; i += step) {
+        pos.push_back(i);
+    }
+    pos.push_back(length - 1);
+    return pos;
+}
+
+// Set the number of work units used by an ITK object
+template <class T>
+void SetNumberOfWorkUnits(T* obj, unsigned n)
+{
+#if ITK_VERSION_MAJOR >= 5
+    obj->SetNumberOfWorkUnits(n);
+#else
+    obj->SetNumberOfThreads(n);
+#endif
+}
+
+// Options shared by all registration engines for a single pyramid level
+template <class TImage>
+struct LevelOptions {
+    typename TImage::Pointer fixed;
+    typename TImage::Pointer moving;
+    MaskSpatialObject::Pointer movingMask;
+    std::vector<cv::Point> samples;
+    size_t histogramBins{0};
+    DeformableRegistration::Transform::Pointer transform;
+    size_t iterations{0};
+    double maxStepLength{0};
+    double minStepLength{0};
+    double relaxationFactor{0};
+    double gradMagTol{0};
+    unsigned threads{0};
+    bool reportMetrics{false};
+    IterationObserver observer;
+    IterationInfo info;
+    Clock::time_point deadline{Clock::time_point::max()};
+    filesystem::path checkpointPath;
+    double checkpointInterval{0};
 };
 
+// Attach an iteration callback to an optimizer as requested
+template <class TOptimizer, class TImage, class TMetric>
+auto AddIterationCallback(
+    TOptimizer* optimizer,
+    const TMetric* metric,
+    const LevelOptions<TImage>& opts) ->
+    typename IterationCallback<TOptimizer>::Pointer
+{
+    if (not opts.reportMetrics and not opts.observer and
+        opts.deadline == Clock::time_point::max() and
+        opts.checkpointPath.empty()) {
+        return nullptr;
+    }
+    auto callback = IterationCallback<TOptimizer>::New();
+    callback->optimizer = optimizer;
+    callback->transform = opts.transform;
+    callback->reportMetrics = opts.reportMetrics;
+    callback->observer = opts.observer;
+    callback->info = opts.info;
+    callback->metricTime = [metric]() { return metric->elapsed(); };
+    callback->deadline = opts.deadline;
+    callback->checkpointPath = opts.checkpointPath;
+    callback->checkpointInterval = opts.checkpointInterval;
+    optimizer->AddObserver(itk::IterationEvent(), callback);
+    return callback;
+}
+
+// Run a level with the legacy ImageRegistrationMethod and return the final
+// transform parameters
+template <class TImage>
+auto RunLegacyLevel(const LevelOptions<TImage>& opts) -> BSplineParameters
+{
+    auto metric = TimedMetric<TImage>::New();
+    auto optimizer = Optimizer::New();
+    auto registration = Registration<TImage>::New();
+    auto grayInterpolator = GrayInterpolator<TImage>::New();
+    auto callback = AddIterationCallback(
+        optimizer.GetPointer(), metric.GetPointer(), opts);
+
+    registration->SetFixedImage(opts.fixed);
+    registration->SetMovingImage(opts.moving);
+    registration->SetMetric(metric);
+    registration->SetOptimizer(optimizer);
+    registration->SetInterpolator(grayInterpolator);
+    registration->SetTransform(opts.transform);
+    registration->SetInitialTransformParameters(
+        opts.transform->GetParameters());
+    if (opts.threads > 0) {
+        SetNumberOfWorkUnits(registration.GetPointer(), opts.threads);
+        SetNumberOfWorkUnits(metric.GetPointer(), opts.threads);
+    }
+
+    auto fixedRegion = opts.fixed->GetBufferedRegion();
+    registration->SetFixedImageRegion(fixedRegion);
+
+    // Sample positions have already been restricted to the fixed mask
+    metric->SetNumberOfHistogramBins(opts.histogramBins);
+    typename Metric<TImage>::FixedImageIndexContainer indices;
+    indices.reserve(opts.samples.size());
+    for (const auto& p : opts.samples) {
+        typename TImage::IndexType idx;
+        idx[0] = p.x;
+        idx[1] = p.y;
+        indices.push_back(idx);
+    }
+    metric->SetFixedImageIndexes(indices);
+    metric->SetUseFixedImageIndexes(true);
+    if (opts.movingMask) {
+        metric->SetMovingImageMask(opts.movingMask);
+    }
+
+    ///// Setup Optimizer /////
+    optimizer->MinimizeOn();
+    optimizer->SetMaximumStepLength(opts.maxStepLength);
+    optimizer->SetMinimumStepLength(opts.minStepLength);
+    optimizer->SetRelaxationFactor(opts.relaxationFactor);
+    optimizer->SetNumberOfIterations(opts.iterations);
+    optimizer->SetGradientMagnitudeTolerance(opts.gradMagTol);
+
+    ///// Run Registration /////
+    if (callback) {
+        callback->start();
+    }
+    registration->Update();
+
+    // Report final values as requested
+    if (opts.reportMetrics) {
+        std::cout << "Stop Condition: ";
+        std::cout << optimizer->GetStopConditionDescription() << "\n";
+        std::cout << "Final Metric Value:" << optimizer->GetValue() << "\n";
+    }
+
+    BSplineParameters parameters = registration->GetLastTransformParameters();
+    return callback ? callback->result(parameters) : parameters;
+}
+
+// Run a level with ImageRegistrationMethodv4 and return the final transform
+// parameters
+template <class TImage>
+auto RunV4Level(const LevelOptions<TImage>& opts) -> BSplineParameters
+{
+    using RegistrationType = RegistrationV4<TImage>;
+    auto metric = TimedMetricV4<TImage>::New();
+    auto optimizer = OptimizerV4::New();
+    auto registration = RegistrationType::New();
+    auto callback = AddIterationCallback(
+        optimizer.GetPointer(), metric.GetPointer(), opts);
+
+    // Gradients are computed on the fly rather than precomputing full
+    // gradient images
+    metric->SetNumberOfHistogramBins(opts.histogramBins);
+    metric->SetUseFixedImageGradientFilter(false);
+    metric->SetUseMovingImageGradientFilter(false);
+    if (opts.movingMask) {
+        metric->SetMovingImageMask(opts.movingMask);
+    }
+
+    // Sample positions have already been restricted to the fixed mask
+    using PointSet = typename MetricV4<TImage>::FixedSampledPointSetType;
+    auto samples = PointSet::New();
+    samples->Initialize();
+    typename PointSet::PointIdentifier id{0};
+    for (const auto& p : opts.samples) {
+        typename TImage::IndexType idx;
+        idx[0] = p.x;
+        idx[1] = p.y;
+        typename PointSet::PointType pt;
+        opts.fixed->TransformIndexToPhysicalPoint(idx, pt);
+        samples->SetPoint(id++, pt);
+    }
+    metric->SetFixedSampledPointSet(samples);
+    metric->SetUseSampledPointSet(true);
+
+    // The transform is optimized in place. Levels are handled by compute(),
+    // so the method itself always runs a single level at full scale.
+    registration->SetFixedImage(opts.fixed);
+    registration->SetMovingImage(opts.moving);
+    registration->SetMetric(metric);
+    registration->SetOptimizer(optimizer);
+    registration->SetInitialTransform(opts.transform);
+    registration->InPlaceOn();
+
+    typename RegistrationType::ShrinkFactorsArrayType shrinkFactors(1);
+    shrinkFactors.Fill(1);
+    typename RegistrationType::SmoothingSigmasArrayType smoothingSigmas(1);
+    smoothingSigmas.Fill(0);
+    registration->SetNumberOfLevels(1);
+    registration->SetShrinkFactorsPerLevel(shrinkFactors);
+    registration->SetSmoothingSigmasPerLevel(smoothingSigmas);
+
+    registration->SetMetricSamplingStrategy(RegistrationType::NONE);
+
+    if (opts.threads > 0) {
+        SetNumberOfWorkUnits(registration.GetPointer(), opts.threads);
+        SetNumberOfWorkUnits(optimizer.GetPointer(), opts.threads);
+#if ITK_VERSION_MAJOR >= 5
+        metric->SetMaximumNumberOfWorkUnits(opts.threads);
+#else
+        metric->SetMaximumNumberOfThreads(opts.threads);
+#endif
+    }
+
+    ///// Setup Optimizer /////
+    // The learning rate is the initial step length
+    optimizer->SetLearningRate(opts.maxStepLength);
+    optimizer->SetMinimumStepLength(opts.minStepLength);
+    optimizer->SetRelaxationFactor(opts.relaxationFactor);
+    optimizer->SetNumberOfIterations(opts.iterations);
+    optimizer->SetGradientMagnitudeTolerance(opts.gradMagTol);
+    optimizer->SetDoEstimateLearningRateOnce(false);
+    optimizer->SetDoEstimateLearningRateAtEachIteration(false);
+
+    ///// Run Registration /////
+    if (callback) {
+        callback->start();
+    }
+    registration->Update();
+
+    // Report final values as requested
+    if (opts.reportMetrics) {
+        std::cout << "Stop Condition: ";
+        std::cout << optimizer->GetStopConditionDescription() << "\n";
+        std::cout << "Final Metric Value:" << optimizer->GetValue() << "\n";
+    }
+
+    BSplineParameters parameters = opts.transform->GetParameters();
+    return callback ? callback->result(parameters) : parameters;
+}
+}  // namespace
+
 void DeformableRegistration::setFixedImage(const cv::Mat& i)
 {
     fixedImage_ = i;
@@ -82,6 +739,13 @@ void DeformableRegistration::setMovingImage(const cv::Mat& i)
     movingImage_ = i;
 }
 
+void DeformableRegistration::setFixedMask(const cv::Mat& m) { fixedMask_ = m; }
+
+void DeformableRegistration::setMovingMask(const cv::Mat& m)
+{
+    movingMask_ = m;
+}
+
 void DeformableRegistration::setNumberOfIterations(size_t i)
 {
     iterations_ = i;
@@ -99,6 +763,119 @@ auto DeformableRegistration::getMeshFillSize() const -> uint32_t
     return meshFillSize_;
 }
 
+void DeformableRegistration::setNumberOfLevels(size_t i)
+{
+    if (i > MAX_LEVELS) {
+        throw std::invalid_argument(
+            "number of levels must be at most " + std::to_string(MAX_LEVELS));
+    }
+    levels_ = std::max<size_t>(i, 1);
+}
+
+auto DeformableRegistration::getNumberOfLevels() const -> size_t
+{
+    return shrinkSchedule_().size();
+}
+
+void DeformableRegistration::setShrinkFactors(const std::vector<unsigned>& f)
+{
+    if (std::find(f.begin(), f.end(), 0U) != f.end()) {
+        throw std::invalid_argument("Shrink factors must be greater than 0");
+    }
+    shrinkFactors_ = f;
+}
+
+auto DeformableRegistration::getShrinkFactors() const -> std::vector<unsigned>
+{
+    return shrinkFactors_;
+}
+
+void DeformableRegistration::setIterationsPerLevel(const std::vector<size_t>& i)
+{
+    levelIters_ = i;
+}
+
+auto DeformableRegistration::getIterationsPerLevel() const
+    -> std::vector<size_t>
+{
+    return levelIters_;
+}
+
+void DeformableRegistration::setEngine(Engine e) { engine_ = e; }
+
+auto DeformableRegistration::getEngine() const -> Engine { return engine_; }
+
+void DeformableRegistration::setNumberOfThreads(unsigned i) { threads_ = i; }
+
+auto DeformableRegistration::getNumberOfThreads() const -> unsigned
+{
+    return threads_;
+}
+
+void DeformableRegistration::setTileSize(int i) { tileSize_ = i; }
+
+auto DeformableRegistration::getTileSize() const -> int { return tileSize_; }
+
+void DeformableRegistration::setTileOverlap(int i) { tileOverlap_ = i; }
+
+auto DeformableRegistration::getTileOverlap() const -> int
+{
+    return tileOverlap_;
+}
+
+auto DeformableRegistration::shrinkSchedule_() const -> std::vector<unsigned>
+{
+    if (not shrinkFactors_.empty()) {
+        return shrinkFactors_;
+    }
+
+    std::vector<unsigned> factors;
+    for (auto l = levels_; l > 0; l--) {
+        factors.push_back(1U << (l - 1));
+    }
+    return factors;
+}
+
+void DeformableRegistration::setSamplingStrategy(Sampling s)
+{
+    sampling_ = s;
+}
+
+auto DeformableRegistration::getSamplingStrategy() const -> Sampling
+{
+    return sampling_;
+}
+
+void DeformableRegistration::setSamplingPercentage(double p)
+{
+    if (p <= 0.0 or p > 1.0) {
+        throw std::invalid_argument("Sampling percentage must be in (0, 1]");
+    }
+    samplingPct_ = p;
+}
+
+auto DeformableRegistration::getSamplingPercentage() const -> double
+{
+    return samplingPct_;
+}
+
+void DeformableRegistration::setHistogramBins(size_t b)
+{
+    if (b == 0) {
+        throw std::invalid_argument("Histogram bins must be greater than 0");
+    }
+    histogramBins_ = b;
+}
+
+auto DeformableRegistration::getHistogramBins() const -> size_t
+{
+    return histogramBins_;
+}
+
+void DeformableRegistration::setRandomSeed(int s) { seed_ = s; }
+
+auto DeformableRegistration::getRandomSeed() const -> int { return seed_; }
+
 void DeformableRegistration::setGradientMagnitudeTolerance(double i)
 {
     gradMagTol_ = i;
@@ -109,8 +886,71 @@ auto DeformableRegistration::getGradientMagnitudeTolerance() const -> double
     return gradMagTol_;
 }
 
+void DeformableRegistration::setInitialTransform(
+    const rt::Transform::Pointer& t)
+{
+    if (not t) {
+        initial_ = nullptr;
+        return;
+    }
+    // B-Spline landmark warps have the same type as deformable stages, so
+    // only an unambiguous transform is accepted
+    std::vector<const Transform*> found;
+    FindBSplineTransforms(t.GetPointer(), found);
+    if (found.empty()) {
+        throw std::invalid_argument(
+            "Initial transform does not contain a B-Spline transform");
+    }
+    if (found.size() > 1) {
+        throw std::invalid_argument(
+            "Initial transform contains " + std::to_string(found.size()) +
+            " B-Spline transforms. Pass the deformable stage alone.");
+    }
+    initial_ = CopyTransform(found.front());
+}
+
+auto DeformableRegistration::getInitialTransform() const -> Transform::Pointer
+{
+    return initial_;
+}
+
+void DeformableRegistration::setTimeBudget(double seconds)
+{
+    timeBudget_ = seconds;
+}
+
+auto DeformableRegistration::getTimeBudget() const -> double
+{
+    return timeBudget_;
+}
+
+void DeformableRegistration::setCheckpointPath(const filesystem::path& p)
+{
+    checkpointPath_ = p;
+}
+
+auto DeformableRegistration::getCheckpointPath() const -> filesystem::path
+{
+    return checkpointPath_;
+}
+
+void DeformableRegistration::setCheckpointInterval(double seconds)
+{
+    checkpointInterval_ = seconds;
+}
+
+auto DeformableRegistration::getCheckpointInterval() const -> double
+{
+    return checkpointInterval_;
+}
+
 void DeformableRegistration::setReportMetrics(bool i) { reportMetrics_ = i; }
 
+void DeformableRegistration::setIterationObserver(IterationObserver o)
+{
+    observer_ = std::move(o);
+}
+
 auto DeformableRegistration::getReportMetrics() const -> bool
 {
     return reportMetrics_;
@@ -119,86 +959,380 @@ auto DeformableRegistration::getReportMetrics() const -> bool
 auto DeformableRegistration::compute()
     -> DeformableRegistration::Transform::Pointer
 {
+    // The time budget covers all levels and tiles
+    if (tile_ < 0) {
+        deadline_ = Clock::time_point::max();
+        if (timeBudget_ > 0) {
+            deadline_ = Clock::now() +
+                        std::chrono::duration_cast<Clock::duration>(
+                            std::chrono::duration<double>(timeBudget_));
+        }
+    }
+
+    // Run tiled registration as requested
+    if (tileSize_ > 0 and
+        (fixedImage_.cols > tileSize_ or fixedImage_.rows > tileSize_)) {
+        return computeTiled_();
+    }
+
     ///// Create grayscale images /////
-    auto fixed8u = QuantizeImage(fixedImage_, CV_8U);
-    auto fixed = CVMatToITKImage<Image8UC1>(fixed8u);
-    auto moving8u = QuantizeImage(movingImage_, CV_8U);
-    auto moving = CVMatToITKImage<Image8UC1>(moving8u);
+    // Registration is run at the native image depth whenever the metric
+    // supports it. Otherwise, images are converted to floating point.
+    auto nativeDepth = [](const cv::Mat& m) {
+        auto d = m.depth();
+        return (d == CV_8U or d == CV_16U or d == CV_32F) ? d : CV_32F;
+    };
+    auto depth = nativeDepth(fixedImage_);
+    cv::Mat fixed = fixedImage_;
+    if (fixed.depth() != depth) {
+        fixedImage_.convertTo(fixed, depth);
+    }
+    cv::Mat moving = movingImage_;
+    if (moving.depth() != nativeDepth(moving)) {
+        movingImage_.convertTo(moving, nativeDepth(moving));
+    }
+    fixed = ColorConvertImage(fixed, 1);
+    moving = ColorConvertImage(QuantizeImage(moving, depth), 1);
 
-    ///// Setup the BSpline Transform /////
-    output_ = Transform::New();
+    // Binary masks
+    auto fixedMask = BinarizeMask(fixedMask_, fixed.size());
+    auto movingMask = BinarizeMask(movingMask_, moving.size());
+    if (not fixedMask.empty() and cv::countNonZero(fixedMask) == 0) {
+        throw std::invalid_argument("Fixed mask is empty");
+    }
+
+    switch (depth) {
+        case CV_8U:
+            return computeLevels_<Image8UC1>(
+                fixed, moving, fixedMask, movingMask);
+        case CV_16U:
+            return computeLevels_<Image16UC1>(
+                fixed, moving, fixedMask, movingMask);
+        default:
+            return computeLevels_<Image32FC1>(
+                fixed, moving, fixedMask, movingMask);
+    }
+}
+
+template <typename TImage>
+auto DeformableRegistration::computeLevels_(
+    const cv::Mat& fixedImg,
+    const cv::Mat& movingImg,
+    const cv::Mat& fixedMask,
+    const cv::Mat& movingMask) -> DeformableRegistration::Transform::Pointer
+{
+    ///// Setup the BSpline transform domain /////
+    // The domain is always defined by the full-resolution fixed image, so
+    // every pyramid level optimizes the same physical transform
     Transform::PhysicalDimensionsType fixedPhysicalDims;
-    Transform::MeshSizeType meshSize;
+    fixedPhysicalDims[0] = static_cast<double>(fixedImg.cols - 1);
+    fixedPhysicalDims[1] = static_cast<double>(fixedImg.rows - 1);
     Transform::OriginType fixedOrigin;
+    fixedOrigin.Fill(0);
+    Transform::DirectionType fixedDirection;
+    fixedDirection.SetIdentity();
 
-    for (auto i = 0; i < 2; i++) {
-        fixedOrigin[i] = fixed->GetOrigin()[i];
-        fixedPhysicalDims[i] =
-            fixed->GetSpacing()[i] *
-            static_cast<double>(
-                fixed->GetLargestPossibleRegion().GetSize()[i] - 1);
+    // Optimizer step lengths are in physical units
+    auto regionWidth = static_cast<double>(fixedImg.cols);
+    auto maxStepLength = regionWidth * DEFAULT_MAX_STEP_FACTOR;
+    auto minStepLength = regionWidth * DEFAULT_MIN_STEP_FACTOR;
+
+    // Metric sampling is reproducible if a seed was provided
+    std::mt19937 rng(seed_ >= 0 ? static_cast<unsigned>(seed_)
+                                : std::random_device{}());
+
+    ///// Run each pyramid level /////
+    output_ = nullptr;
+    auto factors = shrinkSchedule_();
+    auto numLevels = factors.size();
+    for (size_t level = 0; level < numLevels; level++) {
+        // Keep the result of the last completed level if out of time
+        if (output_ and Clock::now() >= deadline_) {
+            if (reportMetrics_) {
+                std::cout << "Time budget exhausted after " << level;
+                std::cout << " level(s)" << std::endl;
+            }
+            break;
+        }
+
+        // Level images
+        auto fixedSmall = ShrinkMat(fixedImg, factors[level]);
+        auto fixed = ImportShrunkImage<TImage>(fixedSmall, fixedImg.size());
+        auto moving = ImportShrunkImage<TImage>(
+            ShrinkMat(movingImg, factors[level]), movingImg.size());
+        auto fixedMaskSmall = ShrinkMask(fixedMask, factors[level]);
+        auto movingMaskSmall = ShrinkMask(movingMask, factors[level]);
+
+        // Mesh is halved for each level below the finest
+        auto shift = numLevels - 1 - level;
+        Transform::MeshSizeType meshSize;
+        meshSize.Fill(std::max<uint32_t>(
+            1, shift < 32 ? meshFillSize_ >> shift : 0));
+
+        // Initialize the level transform
+        if (not output_ and initial_) {
+            output_ = CopyTransform(initial_);
+        } else if (not output_) {
+            output_ = Transform::New();
+            output_->SetTransformDomainOrigin(fixedOrigin);
+            output_->SetTransformDomainPhysicalDimensions(fixedPhysicalDims);
+            output_->SetTransformDomainMeshSize(meshSize);
+            output_->SetTransformDomainDirection(fixedDirection);
+
+            BSplineParameters parameters(output_->GetNumberOfParameters());
+            parameters.Fill(0.0);
+            output_->SetParametersByValue(parameters);
+        }
+
+        // Refine the previous level's control grid or resample the initial
+        // transform onto the fixed image domain
+        if (output_->GetTransformDomainMeshSize() != meshSize or
+            output_->GetTransformDomainOrigin() != fixedOrigin or
+            output_->GetTransformDomainPhysicalDimensions() !=
+                fixedPhysicalDims or
+            output_->GetTransformDomainDirection() != fixedDirection) {
+            auto adaptor = BSplineAdaptor::New();
+            adaptor->SetTransform(output_);
+            adaptor->SetRequiredTransformDomainOrigin(fixedOrigin);
+            adaptor->SetRequiredTransformDomainPhysicalDimensions(
+                fixedPhysicalDims);
+            adaptor->SetRequiredTransformDomainMeshSize(meshSize);
+            adaptor->SetRequiredTransformDomainDirection(fixedDirection);
+            adaptor->AdaptTransformParameters();
+        }
+
+        if (reportMetrics_ and numLevels > 1) {
+            std::cout << "Level " << level + 1 << "/" << numLevels;
+            std::cout << " (shrink factor: " << factors[level] << ", mesh: ";
+            std::cout << meshSize[0] << ")" << std::endl;
+        }
+
+        ///// Run Registration /////
+        LevelOptions<TImage> opts;
+        opts.fixed = fixed;
+        opts.moving = moving;
+        opts.movingMask = ImportMask(movingMaskSmall, movingImg.size());
+        opts.samples = SamplePositions(
+            fixedSmall.size(), fixedMaskSmall, sampling_, samplingPct_, rng);
+        if (opts.samples.empty()) {
+            throw std::runtime_error("No metric sample positions in image");
+        }
+        opts.histogramBins = histogramBins_;
+        opts.transform = output_;
+        opts.iterations = level < levelIters_.size() ? levelIters_[level]
+                                                     : iterations_;
+        opts.maxStepLength = maxStepLength;
+        opts.minStepLength = minStepLength;
+        opts.relaxationFactor = relaxationFactor_;
+        opts.gradMagTol = gradMagTol_;
+        opts.threads = threads_;
+        opts.reportMetrics = reportMetrics_;
+        opts.observer = observer_;
+        opts.info.stage = "deformable";
+        opts.info.tile = tile_;
+        opts.info.level = level;
+        opts.deadline = deadline_;
+        opts.checkpointPath = checkpointPath_;
+        opts.checkpointInterval = checkpointInterval_;
+
+        BSplineParameters parameters;
+        if (engine_ == Engine::Legacy) {
+            parameters = RunLegacyLevel(opts);
+        } else {
+            parameters = RunV4Level(opts);
+        }
+        output_->SetParametersByValue(parameters);
     }
-    meshSize.Fill(meshFillSize_);
 
-    output_->SetTransformDomainOrigin(fixedOrigin);
-    output_->SetTransformDomainPhysicalDimensions(fixedPhysicalDims);
-    output_->SetTransformDomainMeshSize(meshSize);
-    output_->SetTransformDomainDirection(fixed->GetDirection());
+    return output_;
+}
 
-    const auto numParams = output_->GetNumberOfParameters();
-    BSplineParameters parameters(numParams);
-    parameters.Fill(0.0);
-    output_->SetParameters(parameters);
+auto DeformableRegistration::computeTiled_()
+    -> DeformableRegistration::Transform::Pointer
+{
+    if (fixedImage_.size() != movingImage_.size()) {
+        throw std::invalid_argument(
+            "Tiled registration requires images of the same size");
+    }
 
-    ///// Setup Registration and Metrics /////
-    auto metric = Metric::New();
-    auto optimizer = Optimizer::New();
-    auto registration = Registration::New();
-    auto grayInterpolator = GrayInterpolator::New();
+    ///// Split the fixed domain into overlapping tiles /////
+    auto w = fixedImage_.cols;
+    auto h = fixedImage_.rows;
+    auto overlap = std::max(0, tileOverlap_);
+    std::vector<cv::Rect> tiles;
+    for (int y = 0; y < h; y += tileSize_) {
+        for (int x = 0; x < w; x += tileSize_) {
+            cv::Rect tile{
+                x - overlap, y - overlap, tileSize_ + 2 * overlap,
+                tileSize_ + 2 * overlap};
+            tiles.push_back(tile & cv::Rect{0, 0, w, h});
+        }
+    }
+    auto numTiles = static_cast<int>(tiles.size());
     if (reportMetrics_) {
-        optimizer->AddObserver(
-            itk::IterationEvent(), ReportMetricCallback::New());
+        std::cout << "Registering " << numTiles << " tiles..." << std::endl;
     }
 
-    registration->SetFixedImage(fixed);
-    registration->SetMovingImage(moving);
-    registration->SetMetric(metric);
-    registration->SetOptimizer(optimizer);
-    registration->SetInterpolator(grayInterpolator);
-    registration->SetTransform(output_);
-    registration->SetInitialTransformParameters(output_->GetParameters());
+    ///// Register the tiles in parallel /////
+    // Each tile's displacement is sampled a few times per control point
+    // interval and weighted so that neighboring tiles cross-fade over their
+    // shared overlap region
+    struct TileSamples {
+        std::vector<cv::Point> points;
+        std::vector<Vector> displacements;
+        std::vector<double> weights;
+    };
+    std::vector<TileSamples> samples(tiles.size());
+    auto meshSpacing = static_cast<double>(tileSize_) /
+                       std::max<uint32_t>(meshFillSize_, 1);
+    auto step = std::max(1, static_cast<int>(meshSpacing / 4));
+    auto ramp = [o = 2.0 * overlap](double d) {
+        return o > 0 ? std::min((d + 1.0) / (o + 1.0), 1.0) : 1.0;
+    };
 
-    auto fixedRegion = fixed->GetBufferedRegion();
-    registration->SetFixedImageRegion(fixedRegion);
+    // Sample a tile's displacements. A null transform is the identity.
+    auto sampleTile = [&](int t, const Transform::Pointer& tfm) {
+        constexpr auto INF = std::numeric_limits<double>::infinity();
+        const auto& tile = tiles[t];
+        auto& s = samples[t];
+        for (auto y : TileSamplePositions(tile.height, step)) {
+            auto dt = tile.y > 0 ? y : INF;
+            auto db = tile.br().y < h ? tile.height - 1 - y : INF;
+            auto wy = ramp(std::min(dt, db));
+            for (auto x : TileSamplePositions(tile.width, step)) {
+                auto dl = tile.x > 0 ? x : INF;
+                auto dr = tile.br().x < w ? tile.width - 1 - x : INF;
+                auto wx = ramp(std::min(dl, dr));
 
-    metric->SetNumberOfHistogramBins(DEFAULT_HISTOGRAM_BINS);
-    auto numSamples = static_cast<size_t>(
-        fixedRegion.GetNumberOfPixels() * DEFAULT_SAMPLE_FACTOR);
-    metric->SetNumberOfSpatialSamples(numSamples);
+                Transform::InputPointType p;
+                p[0] = x;
+                p[1] = y;
+                s.points.emplace_back(tile.x + x, tile.y + y);
+                if (tfm) {
+                    s.displacements.emplace_back(tfm->TransformPoint(p) - p);
+                } else {
+                    s.displacements.emplace_back(0.0);
+                }
+                s.weights.push_back(wx * wy);
+            }
+        }
+    };
 
-    ///// Setup Optimizer /////
-    auto regionWidth =
-        static_cast<double>(fixed->GetLargestPossibleRegion().GetSize()[0]);
-    auto maxStepLength = regionWidth * DEFAULT_MAX_STEP_FACTOR;
-    auto minStepLength = regionWidth * DEFAULT_MIN_STEP_FACTOR;
+    std::atomic<int> registered{0};
+    auto stripes = threads_ > 0 ? std::min<double>(threads_, numTiles) : -1.0;
+    cv::parallel_for_(
+        cv::Range(0, numTiles),
+        [&](const cv::Range& range) {
+            for (auto t = range.start; t < range.end; t++) {
+                const auto& tile = tiles[t];
 
-    optimizer->MinimizeOn();
-    optimizer->SetMaximumStepLength(maxStepLength);
-    optimizer->SetMinimumStepLength(minStepLength);
-    optimizer->SetRelaxationFactor(relaxationFactor_);
-    optimizer->SetNumberOfIterations(iterations_);
-    optimizer->SetGradientMagnitudeTolerance(gradMagTol_);
+                // Tiles which are not registered keep the initial transform,
+                // so that the fit does not pull them toward the identity
+                Transform::Pointer initial;
+                if (initial_) {
+                    initial = TileTransform(initial_, tile.tl());
+                }
+                if (Clock::now() >= deadline_) {
+                    sampleTile(t, initial);
+                    continue;
+                }
 
-    ///// Run Registration /////
-    registration->Update();
+                // Register the tile with the same settings
+                auto reg = *this;
+                reg.tileSize_ = 0;
+                reg.threads_ = 1;
+                reg.reportMetrics_ = false;
+                reg.tile_ = t;
+                reg.checkpointPath_.clear();
+                reg.initial_ = initial;
+                reg.fixedImage_ = fixedImage_(tile);
+                reg.movingImage_ = movingImage_(tile);
+                if (not fixedMask_.empty()) {
+                    reg.fixedMask_ = fixedMask_(tile);
+                    // Nothing to register
+                    if (cv::countNonZero(
+                            ColorConvertImage(reg.fixedMask_, 1)) == 0) {
+                        sampleTile(t, initial);
+                        continue;
+                    }
+                }
+                if (not movingMask_.empty()) {
+                    reg.movingMask_ = movingMask_(tile);
+                }
+                Transform::Pointer tfm;
+                try {
+                    tfm = reg.compute();
+                } catch (const std::exception& e) {
+                    std::cerr << "Warning: Failed to register tile " << t;
+                    std::cerr << ": " << e.what() << std::endl;
+                    sampleTile(t, initial);
+                    continue;
+                }
+                registered++;
+                sampleTile(t, tfm);
+            }
+        },
+        stripes);
+    if (registered == 0) {
+        throw std::runtime_error("Failed to register any tiles");
+    }
 
-    // Report final values as requested
-    if (reportMetrics_) {
-        std::cout << "Stop Condition: ";
-        std::cout << optimizer->GetStopConditionDescription() << "\n";
-        std::cout << "Final Metric Value:" << optimizer->GetValue() << "\n";
+    ///// Blend the tiles into a single B-Spline /////
+    auto points = DisplacementPointSet::New();
+    auto weights = BSplineFitter::WeightsContainerType::New();
+    DisplacementPointSet::PointIdentifier id{0};
+    for (const auto& s : samples) {
+        for (size_t i = 0; i < s.points.size(); i++) {
+            DisplacementPointSet::PointType p;
+            p[0] = s.points[i].x;
+            p[1] = s.points[i].y;
+            points->SetPoint(id, p);
+            points->SetPointData(id, s.displacements[i]);
+            weights->InsertElement(id, s.weights[i]);
+            id++;
+        }
+    }
+    // The blended mesh is as dense as the tile meshes
+    BSplineFitter::ArrayType numControlPoints;
+    numControlPoints[0] = static_cast<unsigned>(std::ceil(w / meshSpacing)) +
+                          Transform::SplineOrder;
+    numControlPoints[1] = static_cast<unsigned>(std::ceil(h / meshSpacing)) +
+                          Transform::SplineOrder;
+
+    DeformationField::PointType origin;
+    origin.Fill(0);
+    DeformationField::SpacingType spacing;
+    spacing.Fill(1);
+    DeformationField::SizeType size;
+    size[0] = w;
+    size[1] = h;
+    DeformationField::DirectionType direction;
+    direction.SetIdentity();
+
+    auto fitter = BSplineFitter::New();
+    fitter->SetInput(points);
+    fitter->SetPointWeights(weights);
+    fitter->SetGenerateOutputImage(false);
+    fitter->SetOrigin(origin);
+    fitter->SetSpacing(spacing);
+    fitter->SetSize(size);
+    fitter->SetDirection(direction);
+    fitter->SetSplineOrder(Transform::SplineOrder);
+    fitter->SetNumberOfControlPoints(numControlPoints);
+    fitter->SetNumberOfLevels(1);
+    fitter->Update();
+
+    // Convert the control point lattice to transform coefficients
+    Transform::CoefficientImageArray coefficients;
+    for (unsigned i = 0; i < 2; i++) {
+        auto selector = CoefficientSelector::New();
+        selector->SetInput(fitter->GetPhiLattice());
+        selector->SetIndex(i);
+        selector->Update();
+        coefficients[i] = selector->GetOutput();
     }
 
-    output_->SetParameters(registration->GetLastTransformParameters());
+    output_ = Transform::New();
+    output_->SetCoefficientImages(coefficients);
     return output_;
-}
\ No newline at end of file
+}
@@ -0,0 +1,111 @@
+#include "rt/io/DeformationFieldIO.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "rt/types/Exceptions.hpp"
+#include "rt/util/String.hpp"
+
+namespace fs = rt::filesystem;
+
+void rt::WriteDeformationField(
+    const fs::path& path, const DeformationField::Pointer& field)
+{
+    std::ofstream ofs{path.string(), std::ios::binary};
+    if (!ofs.is_open()) {
+        auto msg = "could not open file '" + path.string() + "'";
+        throw IOException(msg);
+    }
+
+    // Header
+    auto size = field->GetLargestPossibleRegion().GetSize();
+    std::stringstream ss;
+    ss << "filetype: deformation-field" << std::endl;
+    ss << "version: 1" << std::endl;
+    ss << "width: " << size[0] << std::endl;
+    ss << "height: " << size[1] << std::endl;
+    ss << "<>" << std::endl;
+    ofs << ss.rdbuf();
+
+    // Write the displacements in row-major order
+    auto bytes = size[0] * size[1] * sizeof(Vector);
+    ofs.write(
+        reinterpret_cast<const char*>(field->GetBufferPointer()),
+        static_cast<std::streamsize>(bytes));
+
+    ofs.close();
+}
+
+auto rt::ReadDeformationField(const fs::path& path)
+    -> rt::DeformationField::Pointer
+{
+    std::ifstream ifs{path.string(), std::ios::binary};
+    if (!ifs.is_open()) {
+        auto msg = "could not open file '" + path.string() + "'";
+        throw IOException(msg);
+    }
+
+    struct Header {
+        std::string fileType;
+        int version{0};
+        std::size_t width{0};
+        std::size_t height{0};
+    };
+
+    Header h;
+    std::string line;
+    while (std::getline(ifs, line)) {
+        trim(line);
+
+        // End of the header
+        if (line == "<>") {
+            break;
+        }
+
+        auto strs = split(line, ':');
+        std::for_each(
+            std::begin(strs), std::end(strs), [](auto& t) { trim(t); });
+        if (strs.size() < 2 or strs[0].empty() or strs[0][0] == '#') {
+            continue;
+        } else if (strs[0] == "filetype") {
+            h.fileType = strs[1];
+        } else if (strs[0] == "version") {
+            h.version = std::stoi(strs[1]);
+        } else if (strs[0] == "width") {
+            h.width = std::stoul(strs[1]);
+        } else if (strs[0] == "height") {
+            h.height = std::stoul(strs[1]);
+        }
+    }
+
+    // Sanity check. Do we have a valid header?
+    if (h.fileType != "deformation-field") {
+        throw IOException("File is not a deformation field");
+    } else if (h.version != 1) {
+        auto msg = "Version mismatch. Deformation field file version is " +
+                   std::to_string(h.version) + ", processing version is 1.";
+        throw IOException(msg);
+    } else if (h.width == 0 or h.height == 0) {
+        throw IOException("Deformation field cannot have dimensions == 0");
+    }
+
+    DeformationField::SizeType size;
+    size[0] = h.width;
+    size[1] = h.height;
+    DeformationField::RegionType region;
+    region.SetSize(size);
+
+    auto field = DeformationField::New();
+    field->SetRegions(region);
+    field->Allocate();
+
+    auto bytes =
+        static_cast<std::streamsize>(h.width * h.height * sizeof(Vector));
+    ifs.read(reinterpret_cast<char*>(field->GetBufferPointer()), bytes);
+    if (ifs.gcount() != bytes) {
+        throw IOException("Deformation field file is truncated");
+    }
+
+    return field;
+}
@@ -0,0 +1,168 @@
+#include "rt/io/FeatureIO.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "rt/types/Exceptions.hpp"
+#include "rt/util/String.hpp"
+
+namespace fs = rt::filesystem;
+
+namespace
+{
+// Binary layout of a cv::KeyPoint
+struct KeyPointRecord {
+    float x;
+    float y;
+    float size;
+    float angle;
+    float response;
+    std::int32_t octave;
+    std::int32_t classId;
+};
+static_assert(sizeof(KeyPointRecord) == 28, "unexpected record padding");
+}  // namespace
+
+void rt::WriteFeatures(const fs::path& path, const ImageFeatures& features)
+{
+    const auto& keys = features.keyPoints;
+    const auto& desc = features.descriptors;
+    if (desc.rows != static_cast<int>(keys.size())) {
+        throw std::invalid_argument("descriptor and key point counts differ");
+    }
+
+    std::ofstream ofs{path.string(), std::ios::binary};
+    if (!ofs.is_open()) {
+        auto msg = "could not open file '" + path.string() + "'";
+        throw IOException(msg);
+    }
+
+    // Header
+    std::stringstream ss;
+    ss << "filetype: features" << std::endl;
+    ss << "version: 1" << std::endl;
+    ss << "keypoints: " << keys.size() << std::endl;
+    ss << "descriptor-type: " << desc.type() << std::endl;
+    ss << "descriptor-cols: " << desc.cols << std::endl;
+    ss << std::setprecision(std::numeric_limits<float>::max_digits10);
+    ss << "scale: " << features.scale << std::endl;
+    ss << "<>" << std::endl;
+    ofs << ss.rdbuf();
+
+    // Key points
+    std::vector<KeyPointRecord> records;
+    records.reserve(keys.size());
+    for (const auto& k : keys) {
+        records.push_back(
+            {k.pt.x, k.pt.y, k.size, k.angle, k.response, k.octave,
+             k.class_id});
+    }
+    ofs.write(
+        reinterpret_cast<const char*>(records.data()),
+        static_cast<std::streamsize>(records.size() * sizeof(KeyPointRecord)));
+
+    // Descriptors in row-major order
+    auto d = desc.isContinuous() ? desc : desc.clone();
+    ofs.write(
+        reinterpret_cast<const char*>(d.data),
+        static_cast<std::streamsize>(d.total() * d.elemSize()));
+
+    ofs.close();
+}
+
+auto rt::ReadFeatures(const fs::path& path) -> ImageFeatures
+{
+    std::ifstream ifs{path.string(), std::ios::binary};
+    if (!ifs.is_open()) {
+        auto msg = "could not open file '" + path.string() + "'";
+        throw IOException(msg);
+    }
+
+    struct Header {
+        std::string fileType;
+        int version{0};
+        std::size_t keypoints{0};
+        int descType{-1};
+        int descCols{0};
+        float scale{1.F};
+    };
+
+    Header h;
+    std::string line;
+    while (std::getline(ifs, line)) {
+        trim(line);
+
+        // End of the header
+        if (line == "<>") {
+            break;
+        }
+
+        auto strs = split(line, ':');
+        std::for_each(
+            std::begin(strs), std::end(strs), [](auto& t) { trim(t); });
+        if (strs.size() < 2 or strs[0].empty() or strs[0][0] == '#') {
+            continue;
+        } else if (strs[0] == "filetype") {
+            h.fileType = strs[1];
+        } else if (strs[0] == "version") {
+            h.version = std::stoi(strs[1]);
+        } else if (strs[0] == "keypoints") {
+            h.keypoints = std::stoul(strs[1]);
+        } else if (strs[0] == "descriptor-type") {
+            h.descType = std::stoi(strs[1]);
+        } else if (strs[0] == "descriptor-cols") {
+            h.descCols = std::stoi(strs[1]);
+        } else if (strs[0] == "scale") {
+            h.scale = std::stof(strs[1]);
+        }
+    }
+
+    // Sanity check. Do we have a valid header?
+    if (h.fileType != "features") {
+        throw IOException("File is not a features file");
+    } else if (h.version != 1) {
+        auto msg = "Version mismatch. Features file version is " +
+                   std::to_string(h.version) + ", processing version is 1.";
+        throw IOException(msg);
+    } else if (h.descType < 0 or h.descCols < 0) {
+        throw IOException("Features file has an invalid descriptor type");
+    }
+
+    // Key points
+    std::vector<KeyPointRecord> records(h.keypoints);
+    auto bytes =
+        static_cast<std::streamsize>(records.size() * sizeof(KeyPointRecord));
+    ifs.read(reinterpret_cast<char*>(records.data()), bytes);
+    if (ifs.gcount() != bytes) {
+        throw IOException("Features file is truncated");
+    }
+
+    ImageFeatures features;
+    features.scale = h.scale;
+    features.keyPoints.reserve(records.size());
+    for (const auto& r : records) {
+        features.keyPoints.emplace_back(
+            cv::Point2f{r.x, r.y}, r.size, r.angle, r.response, r.octave,
+            r.classId);
+    }
+
+    // Descriptors are read directly into their final buffer
+    if (h.keypoints > 0 and h.descCols > 0) {
+        auto rows = static_cast<int>(h.keypoints);
+        features.descriptors.create(rows, h.descCols, h.descType);
+        auto& desc = features.descriptors;
+        bytes = static_cast<std::streamsize>(desc.total() * desc.elemSize());
+        ifs.read(reinterpret_cast<char*>(desc.data), bytes);
+        if (ifs.gcount() != bytes) {
+            throw IOException("Features file is truncated");
+        }
+    }
+
+    return features;
+}
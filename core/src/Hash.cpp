@@ -0,0 +1,51 @@
+#include "rt/util/Hash.hpp"
+
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+auto rt::HashBytes(const void* data, std::size_t size, std::uint64_t seed)
+    -> std::uint64_t
+{
+    constexpr std::uint64_t PRIME{1099511628211ULL};
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < size; i++) {
+        seed ^= bytes[i];
+        seed *= PRIME;
+    }
+    return seed;
+}
+
+auto rt::HashCombine(std::uint64_t seed, std::uint64_t value) -> std::uint64_t
+{
+    return HashBytes(&value, sizeof(value), seed);
+}
+
+auto rt::HashImage(const cv::Mat& img) -> std::uint64_t
+{
+    // Hash the geometry so that equal bytes in different shapes differ
+    auto hash = HASH_SEED;
+    for (auto v : {img.rows, img.cols, img.type()}) {
+        hash = HashCombine(hash, static_cast<std::uint64_t>(v));
+    }
+    if (img.empty()) {
+        return hash;
+    }
+
+    // Hash rows independently, then hash the row hashes in order
+    std::vector<std::uint64_t> rows(img.rows);
+    auto rowBytes = img.cols * img.elemSize();
+    cv::parallel_for_(cv::Range(0, img.rows), [&](const cv::Range& r) {
+        for (auto y = r.start; y < r.end; y++) {
+            rows[y] = HashBytes(img.ptr(y), rowBytes);
+        }
+    });
+    return HashBytes(rows.data(), rows.size() * sizeof(std::uint64_t), hash);
+}
+
+auto rt::HashToString(std::uint64_t hash) -> std::string
+{
+    std::ostringstream ss;
+    ss << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return ss.str();
+}
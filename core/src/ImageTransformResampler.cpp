@@ -1,123 +1,1167 @@
 #include "rt/ImageTransformResampler.hpp"
 
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include <itkBSplineInterpolateImageFunction.h>
+#include <itkDisplacementFieldTransform.h>
+#include <itkLinearInterpolateImageFunction.h>
 #include <itkNearestNeighborInterpolateImageFunction.h>
 #include <itkResampleImageFilter.h>
+#include <itkVectorImage.h>
+#include <itkWindowedSincInterpolateImageFunction.h>
+#include <opencv2/imgproc.hpp>
 
+#include "rt/BSplineGridEvaluator.hpp"
 #include "rt/ITKImageTypes.hpp"
 #include "rt/util/ITKOpenCVBridge.hpp"
 
 using namespace rt;
 
+// Interleaved, multi-channel image type
+template <typename TValue>
+using VectorImage = itk::VectorImage<TValue, 2>;
+
+// Whether a pixel type is an itk::VectorImage pixel
+template <typename T>
+struct IsVariableLengthVector : std::false_type {
+};
+
+template <typename T>
+struct IsVariableLengthVector<itk::VariableLengthVector<T>> : std::true_type {
+};
+
+///// Type dispatch /////
+
+// Carries a type into a generic lambda
+template <typename T>
+struct TypeTag {
+    using type = T;
+};
+
+// Call f(TypeTag<T>{}) where T is the value type of an OpenCV depth. Every
+// depth is instantiated at compile time, so all depths take the same path
+// without conversion.
+template <typename F>
+auto DispatchDepth(int depth, F&& f) -> decltype(f(TypeTag<uint8_t>{}))
+{
+    switch (depth) {
+        case CV_8U:
+            return f(TypeTag<uint8_t>{});
+        case CV_8S:
+            return f(TypeTag<int8_t>{});
+        case CV_16U:
+            return f(TypeTag<uint16_t>{});
+        case CV_16S:
+            return f(TypeTag<int16_t>{});
+        case CV_32S:
+            return f(TypeTag<int32_t>{});
+        case CV_32F:
+            return f(TypeTag<float>{});
+        case CV_64F:
+            return f(TypeTag<double>{});
+        default:
+            throw std::runtime_error("unsupported image type");
+    }
+}
+
+// Call f(std::integral_constant<int, N>{}) for channel counts N in
+// [1, MaxCns], or with N = 0 for any other channel count
+template <int MaxCns, int N = 1, typename F>
+auto DispatchChannels(int cns, F&& f)
+    -> decltype(f(std::integral_constant<int, 0>{}))
+{
+    if constexpr (N > MaxCns) {
+        return f(std::integral_constant<int, 0>{});
+    } else {
+        if (cns == N) {
+            return f(std::integral_constant<int, N>{});
+        }
+        return DispatchChannels<MaxCns, N + 1>(cns, std::forward<F>(f));
+    }
+}
+
+// Import a single-channel image into ITK, sharing its buffer when possible
+template <typename TImageType>
+auto ImportImage(const cv::Mat& m) -> typename TImageType::Pointer
+{
+    if (m.channels() == 1 and m.isContinuous()) {
+        return CVMatToITKImageView<TImageType>(m);
+    }
+    return CVMatToITKImage<TImageType>(m);
+}
+
+// Import a multi-channel image into ITK without splitting or reordering its
+// channels, sharing its buffer when possible
+template <typename TValue>
+auto ImportVectorImage(const cv::Mat& m)
+    -> typename VectorImage<TValue>::Pointer
+{
+    auto container = detail::CVMatImportContainer<TValue>::New();
+    container->setMat(m.isContinuous() ? m : m.clone());
+
+    auto i = detail::NewImage<VectorImage<TValue>>(m.cols, m.rows);
+    i->SetNumberOfComponentsPerPixel(m.channels());
+    i->SetPixelContainer(container);
+    return i;
+}
+
+// Export an itk::VectorImage to an interleaved cv::Mat
+template <typename TValue>
+auto ExportVectorImage(const typename VectorImage<TValue>::Pointer& i)
+    -> cv::Mat
+{
+    auto size = i->GetLargestPossibleRegion().GetSize();
+    auto type = CV_MAKETYPE(
+        cv::DataType<TValue>::depth,
+        static_cast<int>(i->GetNumberOfComponentsPerPixel()));
+    cv::Mat view(
+        static_cast<int>(size[1]), static_cast<int>(size[0]), type,
+        i->GetBufferPointer());
+    return view.clone();
+}
+
+// Create an ITK interpolator. B-spline and windowed sinc interpolation are
+// only available for scalar images.
+template <typename TImageType>
+auto NewInterpolator(Interpolation interpolation) ->
+    typename itk::InterpolateImageFunction<TImageType, double>::Pointer
+{
+    using Pixel = typename TImageType::PixelType;
+    switch (interpolation) {
+        case Interpolation::Nearest: {
+            using I = itk::NearestNeighborInterpolateImageFunction<
+                TImageType, double>;
+            return I::New().GetPointer();
+        }
+        case Interpolation::Linear: {
+            using I = itk::LinearInterpolateImageFunction<TImageType, double>;
+            return I::New().GetPointer();
+        }
+        case Interpolation::BSpline: {
+            if constexpr (std::is_arithmetic_v<Pixel>) {
+                using I = itk::BSplineInterpolateImageFunction<
+                    TImageType, double, double>;
+                return I::New().GetPointer();
+            }
+            break;
+        }
+        case Interpolation::WindowedSinc: {
+            if constexpr (std::is_arithmetic_v<Pixel>) {
+                using W = itk::Function::LanczosWindowFunction<4>;
+                using I = itk::WindowedSincInterpolateImageFunction<
+                    TImageType, 4, W>;
+                return I::New().GetPointer();
+            }
+            break;
+        }
+    }
+    throw std::invalid_argument("unsupported interpolation for pixel type");
+}
+
 template <typename TImageType>
 auto InterpolateImage(
     const typename TImageType::Pointer& m,
-    typename TImageType::SizeType s,
-    Transform::Pointer transform) -> typename TImageType::Pointer
+    const cv::Rect& roi,
+    Transform::Pointer transform,
+    Interpolation interpolation) -> typename TImageType::Pointer
 {
-    using I = itk::NearestNeighborInterpolateImageFunction<TImageType, double>;
     using R = itk::ResampleImageFilter<TImageType, TImageType, double>;
+    using Pixel = typename TImageType::PixelType;
 
-    auto interpolator = I::New();
     auto resample = R::New();
     resample->SetInput(m);
     resample->SetTransform(transform);
-    resample->SetInterpolator(interpolator);
-    resample->SetSize(s);
+    resample->SetInterpolator(NewInterpolator<TImageType>(interpolation));
+    typename TImageType::IndexType start;
+    start[0] = roi.x;
+    start[1] = roi.y;
+    typename TImageType::SizeType size;
+    size[0] = static_cast<itk::SizeValueType>(roi.width);
+    size[1] = static_cast<itk::SizeValueType>(roi.height);
+    resample->SetOutputStartIndex(start);
+    resample->SetSize(size);
+
+    // Vector pixels need a default value with the right number of components
+    if constexpr (IsVariableLengthVector<Pixel>::value) {
+        Pixel zero(m->GetNumberOfComponentsPerPixel());
+        zero.Fill(0);
+        resample->SetDefaultPixelValue(zero);
+    }
+
     resample->Update();
 
     return resample->GetOutput();
 }
 
-auto rt::ImageTransformResampler(
-    const cv::Mat& m, const cv::Size& s, const Transform::Pointer& transform)
+// Resample with ITK. Multi-channel images are resampled as a single vector
+// image so that all channels share one coordinate lookup.
+template <typename TValue>
+auto InterpolateITKImage(
+    const cv::Mat& m,
+    const cv::Rect& roi,
+    const Transform::Pointer& transform,
+    Interpolation interpolation) -> cv::Mat
+{
+    if (m.channels() == 1) {
+        using T = itk::Image<TValue, 2>;
+        auto i = ImportImage<T>(m);
+        i = InterpolateImage<T>(i, roi, transform, interpolation);
+        return ITKImageToCVMat<T>(i);
+    }
+
+    using T = VectorImage<TValue>;
+    auto i = ImportVectorImage<TValue>(m);
+    i = InterpolateImage<T>(i, roi, transform, interpolation);
+    return ExportVectorImage<TValue>(i);
+}
+
+// Resample the output pixels in roi by evaluating the transform with ITK
+auto ResampleWithTransform(
+    const cv::Mat& m,
+    const cv::Rect& roi,
+    const Transform::Pointer& transform,
+    Interpolation interpolation) -> cv::Mat
+{
+    // ITK only provides these kernels for scalar images
+    auto scalarOnly = interpolation == Interpolation::BSpline or
+                      interpolation == Interpolation::WindowedSinc;
+    if (m.channels() > 1 and scalarOnly) {
+        std::vector<cv::Mat> cns;
+        cv::split(m, cns);
+        for (auto& c : cns) {
+            c = ResampleWithTransform(c, roi, transform, interpolation);
+        }
+        cv::Mat result;
+        cv::merge(cns, result);
+        return result;
+    }
+
+    return DispatchDepth(m.depth(), [&](auto tag) {
+        using T = typename decltype(tag)::type;
+        return InterpolateITKImage<T>(m, roi, transform, interpolation);
+    });
+}
+
+///// Cubic B-spline interpolation /////
+
+// Convert samples to cubic B-spline coefficients in place (Unser, 1999).
+// Filters count adjacent values along n samples spaced step values apart,
+// using mirrored boundaries.
+template <typename C>
+void PrefilterLines(C* base, int n, std::ptrdiff_t step, int count)
+{
+    if (n < 2) {
+        return;
+    }
+
+    // Pole and gain of the cubic B-spline prefilter
+    constexpr C Z{-0.267949192431123};
+    constexpr C LAMBDA{6};
+    auto line = [&](int k) { return base + k * step; };
+
+    for (int k = 0; k < n; k++) {
+        auto* l = line(k);
+        for (int j = 0; j < count; j++) {
+            l[j] *= LAMBDA;
+        }
+    }
+
+    // Causal initialization, truncated once z^k is negligible
+    std::vector<C> sum(line(0), line(0) + count);
+    auto zk = Z;
+    for (int k = 1; k < std::min(n, 12); k++) {
+        const auto* l = line(k);
+        for (int j = 0; j < count; j++) {
+            sum[j] += zk * l[j];
+        }
+        zk *= Z;
+    }
+    std::copy(sum.begin(), sum.end(), line(0));
+
+    // Causal filter
+    for (int k = 1; k < n; k++) {
+        const auto* prev = line(k - 1);
+        auto* l = line(k);
+        for (int j = 0; j < count; j++) {
+            l[j] += Z * prev[j];
+        }
+    }
+
+    // Anti-causal initialization
+    {
+        const auto* prev = line(n - 2);
+        auto* l = line(n - 1);
+        for (int j = 0; j < count; j++) {
+            l[j] = Z / (Z * Z - C(1)) * (l[j] + Z * prev[j]);
+        }
+    }
+
+    // Anti-causal filter
+    for (int k = n - 2; k >= 0; k--) {
+        const auto* next = line(k + 1);
+        auto* l = line(k);
+        for (int j = 0; j < count; j++) {
+            l[j] = Z * (next[j] - l[j]);
+        }
+    }
+}
+
+// Coefficients are double for depths which float cannot represent exactly
+auto CoefficientDepth(int depth) -> int
+{
+    return depth == CV_32S or depth == CV_64F ? CV_64F : CV_32F;
+}
+
+// Convert every channel of an image of type C to B-spline coefficients in
+// place
+template <typename C>
+void PrefilterImage(cv::Mat& c)
+{
+    auto cns = c.channels();
+    auto rowLen = c.cols * cns;
+
+    // Along rows: all channels of a row are filtered together
+    cv::parallel_for_(cv::Range(0, c.rows), [&](const cv::Range& r) {
+        for (auto y = r.start; y < r.end; y++) {
+            PrefilterLines(c.ptr<C>(y), c.cols, cns, cns);
+        }
+    });
+
+    // Along columns: a block of whole columns is filtered together
+    auto step = static_cast<std::ptrdiff_t>(c.step1());
+    cv::parallel_for_(cv::Range(0, rowLen), [&](const cv::Range& r) {
+        PrefilterLines(c.ptr<C>() + r.start, c.rows, step, r.size());
+    });
+}
+
+// Compute cubic B-spline coefficients for every channel of an image
+auto BSplineCoefficients(const cv::Mat& m) -> cv::Mat
+{
+    cv::Mat c;
+    m.convertTo(c, CoefficientDepth(m.depth()));
+    if (c.depth() == CV_64F) {
+        PrefilterImage<double>(c);
+    } else {
+        PrefilterImage<float>(c);
+    }
+    return c;
+}
+
+// Cubic B-spline weights of the four samples surrounding offset t in [0, 1)
+template <typename C>
+inline void BSplineWeights(C t, C* w)
+{
+    auto t2 = t * t;
+    auto t3 = t2 * t;
+    auto u = C(1) - t;
+    w[0] = u * u * u / C(6);
+    w[1] = (C(3) * t3 - C(6) * t2 + C(4)) / C(6);
+    w[2] = (C(-3) * t3 + C(3) * t2 + C(3) * t + C(1)) / C(6);
+    w[3] = t3 / C(6);
+}
+
+// Mirror an index into the range [0, n)
+inline auto MirrorIndex(int k, int n) -> int
+{
+    if (n == 1) {
+        return 0;
+    }
+    auto period = 2 * n - 2;
+    k = std::abs(k) % period;
+    return k < n ? k : period - k;
+}
+
+// Evaluate B-spline coefficients of type C at the positions in map and write
+// values of type T. Common channel counts are a template parameter so that
+// the inner loops are fully unrolled. Cns = 0 handles any channel count.
+template <typename T, typename C, int Cns>
+void EvaluateBSpline(const cv::Mat& coeffs, const cv::Mat& map, cv::Mat& out)
+{
+    constexpr int Capacity = Cns > 0 ? Cns : CV_CN_MAX;
+    const int cns = Cns > 0 ? Cns : coeffs.channels();
+    auto w = coeffs.cols;
+    auto h = coeffs.rows;
+    auto maxX = static_cast<float>(w) - 0.5F;
+    auto maxY = static_cast<float>(h) - 0.5F;
+    cv::parallel_for_(cv::Range(0, map.rows), [&](const cv::Range& r) {
+        C acc[Capacity];
+        for (auto y = r.start; y < r.end; y++) {
+            const auto* pos = map.ptr<cv::Vec2f>(y);
+            auto* dst = out.ptr<T>(y);
+            for (int x = 0; x < map.cols; x++, dst += cns) {
+                auto u = pos[x][0];
+                auto v = pos[x][1];
+                // Written so that NaN positions are also rejected
+                if (not(u >= -0.5F and u < maxX and v >= -0.5F and v < maxY)) {
+                    std::fill(dst, dst + cns, T(0));
+                    continue;
+                }
+
+                auto ix = static_cast<int>(std::floor(u));
+                auto iy = static_cast<int>(std::floor(v));
+                C wx[4];
+                C wy[4];
+                BSplineWeights<C>(u - static_cast<float>(ix), wx);
+                BSplineWeights<C>(v - static_cast<float>(iy), wy);
+                int cols[4];
+                for (int i = 0; i < 4; i++) {
+                    cols[i] = MirrorIndex(ix - 1 + i, w) * cns;
+                }
+
+                std::fill(acc, acc + cns, C(0));
+                for (int j = 0; j < 4; j++) {
+                    const auto* row = coeffs.ptr<C>(MirrorIndex(iy - 1 + j, h));
+                    for (int i = 0; i < 4; i++) {
+                        auto wt = wy[j] * wx[i];
+                        const auto* c = row + cols[i];
+                        for (int k = 0; k < cns; k++) {
+                            acc[k] += wt * c[k];
+                        }
+                    }
+                }
+                for (int k = 0; k < cns; k++) {
+                    dst[k] = cv::saturate_cast<T>(acc[k]);
+                }
+            }
+        }
+    });
+}
+
+// Resample an image at the absolute positions in map from its cubic B-spline
+// coefficients
+auto ResampleBSpline(
+    const cv::Mat& m, const cv::Mat& coeffs, const cv::Mat& map) -> cv::Mat
+{
+    cv::Mat out(map.size(), m.type());
+    DispatchDepth(m.depth(), [&](auto valueTag) {
+        using T = typename decltype(valueTag)::type;
+        DispatchChannels<4>(m.channels(), [&](auto cnsTag) {
+            constexpr int Cns = decltype(cnsTag)::value;
+            if (coeffs.depth() == CV_64F) {
+                EvaluateBSpline<T, double, Cns>(coeffs, map, out);
+            } else {
+                EvaluateBSpline<T, float, Cns>(coeffs, map, out);
+            }
+        });
+    });
+    return out;
+}
+
+///// Field resampling /////
+
+// cv::remap stores integer coordinates as shorts
+auto FitsRemap(const cv::Size& s) -> bool
+{
+    return s.width < SHRT_MAX and s.height < SHRT_MAX;
+}
+
+// Whether cv::remap and cv::warpAffine can resample image m into an output of
+// size s. OpenCV only provides nearest neighbor for 8S and 32S images.
+auto CanRemap(const cv::Mat& m, const cv::Size& s, Interpolation interpolation)
+    -> bool
+{
+    auto depth = m.depth();
+    auto kernelOK = interpolation == Interpolation::Nearest or
+                    (depth != CV_8S and depth != CV_32S);
+    return kernelOK and FitsRemap(m.size()) and FitsRemap(s);
+}
+
+auto FieldSize(const DeformationField::Pointer& field) -> cv::Size
+{
+    auto size = field->GetLargestPossibleRegion().GetSize();
+    return {static_cast<int>(size[0]), static_cast<int>(size[1])};
+}
+
+// Allocate a field of size s
+auto NewField(const cv::Size& s) -> DeformationField::Pointer
+{
+    DeformationField::SizeType size;
+    size[0] = static_cast<itk::SizeValueType>(s.width);
+    size[1] = static_cast<itk::SizeValueType>(s.height);
+    DeformationField::RegionType region;
+    region.SetSize(size);
+
+    auto field = DeformationField::New();
+    field->SetRegions(region);
+    field->Allocate();
+    return field;
+}
+
+// Convert a displacement field to an absolute cv::remap map
+auto FieldToMap(const DeformationField::Pointer& field) -> cv::Mat
+{
+    auto s = FieldSize(field);
+    cv::Mat map(s, CV_32FC2);
+    const auto* buffer = field->GetBufferPointer();
+    cv::parallel_for_(cv::Range(0, s.height), [&](const cv::Range& r) {
+        for (auto y = r.start; y < r.end; y++) {
+            const auto* d = buffer + static_cast<std::size_t>(y) * s.width;
+            auto* row = map.ptr<cv::Vec2f>(y);
+            for (int x = 0; x < s.width; x++) {
+                row[x][0] = static_cast<float>(x + d[x][0]);
+                row[x][1] = static_cast<float>(y + d[x][1]);
+            }
+        }
+    });
+    return map;
+}
+
+///// Transform evaluation /////
+
+// Transforms applied one after another, first to last
+using TransformChain = std::vector<const Transform*>;
+
+// Map a point through a chain of transforms
+auto MapPoint(const TransformChain& chain, Transform::InputPointType p)
+    -> Transform::OutputPointType
+{
+    for (const auto* t : chain) {
+        p = t->TransformPoint(p);
+    }
+    return p;
+}
+
+// If a chain of transforms is affine, get its output-to-input mapping as a 2x3
+// matrix. An empty chain is the identity.
+auto AffineMatrix(const TransformChain& chain) -> std::optional<cv::Matx23d>
+{
+    for (const auto* t : chain) {
+        if (not t->IsLinear()) {
+            return std::nullopt;
+        }
+    }
+
+    Transform::InputPointType p;
+    p.Fill(0);
+    auto o = MapPoint(chain, p);
+    p[0] = 1;
+    auto x = MapPoint(chain, p);
+    p[0] = 0;
+    p[1] = 1;
+    auto y = MapPoint(chain, p);
+    return cv::Matx23d{x[0] - o[0], y[0] - o[0], o[0],
+                       x[1] - o[1], y[1] - o[1], o[1]};
+}
+
+// If a transform is affine, get its output-to-input mapping as a 2x3 matrix.
+// Composite transforms are affine when all of their sub-transforms are.
+auto AffineMatrix(const Transform* transform) -> std::optional<cv::Matx23d>
+{
+    return AffineMatrix(TransformChain{transform});
+}
+
+// Call f(x, y, q) with the mapped point q of every pixel in output rows
+// [y0, y0 + rows). Rows are evaluated in parallel. Affine transforms are
+// evaluated from their matrix rather than through TransformPoint. For
+// composites, the transform which is applied first sees the regular pixel
+// grid, so it uses BSplineGridEvaluator when it is a B-spline.
+template <typename F>
+void ForEachMappedPixel(
+    const Transform::Pointer& transform, int width, int y0, int rows, F f)
+{
+    if (auto affine = AffineMatrix(transform)) {
+        const auto& a = *affine;
+        cv::parallel_for_(cv::Range(y0, y0 + rows), [&](const cv::Range& r) {
+            Transform::OutputPointType q;
+            for (auto y = r.start; y < r.end; y++) {
+                auto bx = a(0, 1) * y + a(0, 2);
+                auto by = a(1, 1) * y + a(1, 2);
+                for (int x = 0; x < width; x++) {
+                    q[0] = a(0, 0) * x + bx;
+                    q[1] = a(1, 0) * x + by;
+                    f(x, y, q);
+                }
+            }
+        });
+        return;
+    }
+
+    // Composites apply their last transform first
+    TransformChain chain{transform.GetPointer()};
+    const auto* c = dynamic_cast<const CompositeTransform*>(chain.front());
+    if (c != nullptr and c->GetNumberOfTransforms() > 0) {
+        chain.clear();
+        for (auto i = c->GetNumberOfTransforms(); i-- > 0;) {
+            chain.push_back(c->GetNthTransformConstPointer(i));
+        }
+    }
+    const auto* first = chain.front();
+    TransformChain rest(chain.begin() + 1, chain.end());
+    auto restAffine = AffineMatrix(rest);
+
+    using BSpline = BSplineGridEvaluator::Transform;
+    std::optional<BSplineGridEvaluator> grid;
+    const auto* bspline = dynamic_cast<const BSpline*>(first);
+    if (BSplineGridEvaluator::IsSupported(bspline)) {
+        grid.emplace(bspline, width);
+    }
+
+    cv::parallel_for_(cv::Range(y0, y0 + rows), [&](const cv::Range& r) {
+        std::vector<cv::Point2d> pts(width);
+        Transform::InputPointType p;
+        Transform::OutputPointType q;
+        for (auto y = r.start; y < r.end; y++) {
+            // Apply the first transform to the whole row
+            if (grid) {
+                grid->evaluateRow(y, pts.data());
+            } else {
+                p[1] = y;
+                for (int x = 0; x < width; x++) {
+                    p[0] = x;
+                    q = first->TransformPoint(p);
+                    pts[x] = {q[0], q[1]};
+                }
+            }
+
+            // Apply the remaining transforms
+            for (int x = 0; x < width; x++) {
+                if (restAffine) {
+                    const auto& a = *restAffine;
+                    q[0] = a(0, 0) * pts[x].x + a(0, 1) * pts[x].y + a(0, 2);
+                    q[1] = a(1, 0) * pts[x].x + a(1, 1) * pts[x].y + a(1, 2);
+                } else {
+                    p[0] = pts[x].x;
+                    p[1] = pts[x].y;
+                    q = MapPoint(rest, p);
+                }
+                f(x, y, q);
+            }
+        }
+    });
+}
+
+// Evaluate a transform at output rows [y0, y0 + rows) as absolute cv::remap
+// positions
+auto TransformMap(
+    const Transform::Pointer& transform, int width, int y0, int rows)
     -> cv::Mat
 {
-    switch (m.type()) {
-        case CV_8UC1: {
-            using T = Image8UC1;
-            auto i = CVMatToITKImage<T>(m);
-            i = InterpolateImage<T>(i, {s.width, s.height}, transform);
-            return ITKImageToCVMat<T>(i);
-        }
-        case CV_8UC3: {
-            using T = Image8UC3;
-            auto i = CVMatToITKImage<T>(m);
-            i = InterpolateImage<T>(i, {s.width, s.height}, transform);
-            return ITKImageToCVMat<T>(i);
-        }
-        case CV_8UC2:
-        case CV_8UC4: {
-            // Extract and transform each channel
-            std::vector<cv::Mat> cns;
-            cv::split(m, cns);
-            for (auto& c : cns) {
-                using T = Image8UC1;
-                auto i = CVMatToITKImage<T>(c);
-                i = InterpolateImage<T>(i, {s.width, s.height}, transform);
-                c = ITKImageToCVMat<T>(i);
+    cv::Mat map(rows, width, CV_32FC2);
+    ForEachMappedPixel(transform, width, y0, rows, [&](int x, int y, auto q) {
+        auto& pos = map.at<cv::Vec2f>(y - y0, x);
+        pos[0] = static_cast<float>(q[0]);
+        pos[1] = static_cast<float>(q[1]);
+    });
+    return map;
+}
+
+///// Approximate evaluation /////
+
+// Lattice node positions for an axis of length n: every spacing-th pixel and
+// the last pixel
+auto LatticeNodes(int n, int spacing) -> std::vector<int>
+{
+    std::vector<int> nodes;
+    for (int v = 0; v < n - 1; v += spacing) {
+        nodes.push_back(v);
+    }
+    nodes.push_back(n - 1);
+    return nodes;
+}
+
+// Lattice cell and interpolation weight of pixel coordinate v
+auto LatticeCell(const std::vector<int>& nodes, int v, int spacing)
+    -> std::pair<int, double>
+{
+    if (nodes.size() < 2) {
+        return {0, 0.};
+    }
+    auto last = static_cast<int>(nodes.size()) - 2;
+    auto i = std::min(v / spacing, last);
+    auto t = static_cast<double>(v - nodes[i]) / (nodes[i + 1] - nodes[i]);
+    return {i, t};
+}
+
+// Fill a field by bilinearly interpolating the transform between lattice
+// nodes
+void InterpolateLattice(
+    const Transform::Pointer& transform,
+    int spacing,
+    const DeformationField::Pointer& field)
+{
+    auto s = FieldSize(field);
+    auto xs = LatticeNodes(s.width, spacing);
+    auto ys = LatticeNodes(s.height, spacing);
+
+    // Evaluate the transform at the lattice nodes
+    auto cols = static_cast<int>(xs.size());
+    auto rows = static_cast<int>(ys.size());
+    cv::Mat lattice(rows, cols, CV_64FC2);
+    cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range& r) {
+        Transform::InputPointType p;
+        for (auto j = r.start; j < r.end; j++) {
+            auto* row = lattice.ptr<cv::Vec2d>(j);
+            p[1] = ys[j];
+            for (int i = 0; i < cols; i++) {
+                p[0] = xs[i];
+                auto q = transform->TransformPoint(p);
+                row[i] = {q[0], q[1]};
             }
+        }
+    });
+
+    // Column cells are shared by every row
+    std::vector<std::pair<int, double>> colCells(s.width);
+    for (int x = 0; x < s.width; x++) {
+        colCells[x] = LatticeCell(xs, x, spacing);
+    }
 
-            cv::Mat result(m.rows, m.cols, CV_8U);
-            cv::merge(cns, result);
-            return result;
-        }
-        case CV_16UC1: {
-            using T = Image16UC1;
-            auto i = CVMatToITKImage<T>(m);
-            i = InterpolateImage<T>(i, {s.width, s.height}, transform);
-            return ITKImageToCVMat<T>(i);
-        }
-        case CV_16UC3: {
-            using T = Image16UC3;
-            auto i = CVMatToITKImage<T>(m);
-            i = InterpolateImage<T>(i, {s.width, s.height}, transform);
-            return ITKImageToCVMat<T>(i);
-        }
-        case CV_16UC2:
-        case CV_16UC4: {
-            // Extract and transform each channel
-            std::vector<cv::Mat> cns;
-            cv::split(m, cns);
-            for (auto& c : cns) {
-                using T = Image16UC1;
-                auto i = CVMatToITKImage<T>(c);
-                i = InterpolateImage<T>(i, {s.width, s.height}, transform);
-                c = ITKImageToCVMat<T>(i);
+    auto* buffer = field->GetBufferPointer();
+    cv::parallel_for_(cv::Range(0, s.height), [&](const cv::Range& r) {
+        std::vector<cv::Vec2d> blended(cols);
+        for (auto y = r.start; y < r.end; y++) {
+            // Blend the two lattice rows around this row
+            auto [j, ty] = LatticeCell(ys, y, spacing);
+            const auto* top = lattice.ptr<cv::Vec2d>(j);
+            auto next = std::min(j + 1, rows - 1);
+            const auto* bottom = lattice.ptr<cv::Vec2d>(next);
+            for (int i = 0; i < cols; i++) {
+                blended[i] = top[i] * (1. - ty) + bottom[i] * ty;
             }
 
-            cv::Mat result(m.rows, m.cols, CV_16U);
-            cv::merge(cns, result);
-            return result;
-        }
-        case CV_32FC1: {
-            using T = Image32FC1;
-            auto i = CVMatToITKImage<T>(m);
-            i = InterpolateImage<T>(i, {s.width, s.height}, transform);
-            return ITKImageToCVMat<T>(i);
-        }
-        case CV_32FC3: {
-            using T = Image32FC3;
-            auto i = CVMatToITKImage<T>(m);
-            i = InterpolateImage<T>(i, {s.width, s.height}, transform);
-            return ITKImageToCVMat<T>(i);
-        }
-        case CV_32FC2:
-        case CV_32FC4: {
-            // Extract and transform each channel
-            std::vector<cv::Mat> cns;
-            cv::split(m, cns);
-            for (auto& c : cns) {
-                using T = Image32FC1;
-                auto i = CVMatToITKImage<T>(c);
-                i = InterpolateImage<T>(i, {s.width, s.height}, transform);
-                c = ITKImageToCVMat<T>(i);
+            auto* d = buffer + static_cast<std::size_t>(y) * s.width;
+            for (int x = 0; x < s.width; x++) {
+                auto [i, tx] = colCells[x];
+                auto next = std::min(i + 1, cols - 1);
+                auto q = blended[i] * (1. - tx) + blended[next] * tx;
+                d[x][0] = q[0] - x;
+                d[x][1] = q[1] - y;
             }
+        }
+    });
+}
+
+// Transform which bilinearly interpolates transform evaluated at every
+// spacing-th pixel. The lattice extends past the last row and column so that
+// every pixel of s is inside of it.
+auto LatticeTransform(
+    const Transform::Pointer& transform, const cv::Size& s, int spacing)
+    -> Transform::Pointer
+{
+    auto nodes = [spacing](int n) {
+        return std::max((n + spacing - 2) / spacing + 1, 2);
+    };
+    auto lattice = NewField({nodes(s.width), nodes(s.height)});
+    lattice->SetSpacing(static_cast<double>(spacing));
 
-            cv::Mat result(m.rows, m.cols, CV_32F);
-            cv::merge(cns, result);
-            return result;
+    auto size = FieldSize(lattice);
+    auto* buffer = lattice->GetBufferPointer();
+    cv::parallel_for_(cv::Range(0, size.height), [&](const cv::Range& r) {
+        Transform::InputPointType p;
+        for (auto j = r.start; j < r.end; j++) {
+            p[1] = static_cast<double>(j) * spacing;
+            auto* d = buffer + static_cast<std::size_t>(j) * size.width;
+            for (int i = 0; i < size.width; i++) {
+                p[0] = static_cast<double>(i) * spacing;
+                auto q = transform->TransformPoint(p);
+                d[i][0] = q[0] - p[0];
+                d[i][1] = q[1] - p[1];
+            }
         }
+    });
+
+    using FieldTransform = itk::DisplacementFieldTransform<double, 2>;
+    auto result = FieldTransform::New();
+    result->SetDisplacementField(lattice);
+    return result.GetPointer();
+}
+
+// Fixed, random pixels at which approximations of size s are measured
+auto ErrorSamples(const cv::Size& s) -> std::vector<cv::Point>
+{
+    constexpr int MaxSamples{1024};
+    auto area = static_cast<std::int64_t>(s.width) * s.height;
+    auto count = static_cast<int>(std::min<std::int64_t>(MaxSamples, area));
+    std::vector<cv::Point> samples(count);
+    cv::RNG rng;
+    for (auto& px : samples) {
+        px = {rng.uniform(0, s.width), rng.uniform(0, s.height)};
+    }
+    return samples;
+}
+
+// Largest distance between two transforms at the sampled pixels
+auto MaxTransformError(
+    const Transform::Pointer& exact,
+    const Transform::Pointer& approx,
+    const std::vector<cv::Point>& samples) -> double
+{
+    std::vector<double> errors(samples.size());
+    auto count = static_cast<int>(samples.size());
+    cv::parallel_for_(cv::Range(0, count), [&](const cv::Range& r) {
+        Transform::InputPointType p;
+        for (auto k = r.start; k < r.end; k++) {
+            p[0] = samples[k].x;
+            p[1] = samples[k].y;
+            auto a = exact->TransformPoint(p);
+            auto b = approx->TransformPoint(p);
+            errors[k] = std::hypot(a[0] - b[0], a[1] - b[1]);
+        }
+    });
+    if (errors.empty()) {
+        return 0.;
+    }
+    return *std::max_element(errors.begin(), errors.end());
+}
+
+// Largest distance between the field and the exact transform at the sampled
+// pixels
+auto MaxFieldError(
+    const Transform::Pointer& transform,
+    const DeformationField::Pointer& field,
+    const std::vector<cv::Point>& samples) -> double
+{
+    auto s = FieldSize(field);
+    const auto* buffer = field->GetBufferPointer();
+    std::vector<double> errors(samples.size());
+    auto count = static_cast<int>(samples.size());
+    cv::parallel_for_(cv::Range(0, count), [&](const cv::Range& r) {
+        Transform::InputPointType p;
+        for (auto k = r.start; k < r.end; k++) {
+            const auto& px = samples[k];
+            p[0] = px.x;
+            p[1] = px.y;
+            auto q = transform->TransformPoint(p);
+            auto idx = static_cast<std::size_t>(px.y) * s.width + px.x;
+            const auto& d = buffer[idx];
+            errors[k] = std::hypot(q[0] - px.x - d[0], q[1] - px.y - d[1]);
+        }
+    });
+    if (errors.empty()) {
+        return 0.;
+    }
+    return *std::max_element(errors.begin(), errors.end());
+}
+
+// Get the cv::remap and cv::warpAffine flag for an interpolation kernel
+auto InterpolationFlag(Interpolation interpolation) -> int
+{
+    switch (interpolation) {
+        case Interpolation::Linear:
+            return cv::INTER_LINEAR;
+        case Interpolation::WindowedSinc:
+            return cv::INTER_LANCZOS4;
         default:
-            throw std::runtime_error("unsupported image type");
+            return cv::INTER_NEAREST;
+    }
+}
+
+// Resample an image at the absolute positions in map with cv::remap, which
+// provides SIMD implementations of all kernels except B-spline
+auto RemapImage(
+    const cv::Mat& m, const cv::Mat& map, Interpolation interpolation)
+    -> cv::Mat
+{
+    cv::Mat result;
+    cv::remap(
+        m, result, map, cv::noArray(), InterpolationFlag(interpolation),
+        cv::BORDER_CONSTANT, cv::Scalar::all(0));
+    return result;
+}
+
+// Resample an image through an output-to-input affine matrix with
+// cv::warpAffine, which computes positions on the fly with SIMD
+auto WarpAffine(
+    const cv::Mat& m,
+    const cv::Matx23d& affine,
+    const cv::Size& s,
+    Interpolation interpolation) -> cv::Mat
+{
+    cv::Mat result;
+    cv::warpAffine(
+        m, result, affine, s,
+        InterpolationFlag(interpolation) | cv::WARP_INVERSE_MAP,
+        cv::BORDER_CONSTANT, cv::Scalar::all(0));
+    return result;
+}
+
+// Resample an image at the absolute positions in map
+auto ResampleFromMap(
+    const cv::Mat& m, const cv::Mat& map, Interpolation interpolation)
+    -> cv::Mat
+{
+    if (interpolation == Interpolation::BSpline) {
+        return ResampleBSpline(m, BSplineCoefficients(m), map);
+    }
+    return RemapImage(m, map, interpolation);
+}
+
+auto rt::ComputeDeformationField(
+    const Transform::Pointer& transform, const cv::Size& s)
+    -> DeformationField::Pointer
+{
+    if (not transform) {
+        throw std::invalid_argument("transform is null");
+    }
+
+    auto field = NewField(s);
+
+    // Transform evaluation is const and thread-safe
+    auto* buffer = field->GetBufferPointer();
+    ForEachMappedPixel(
+        transform, s.width, 0, s.height, [&](int x, int y, auto q) {
+            auto& d = buffer[static_cast<std::size_t>(y) * s.width + x];
+            d[0] = q[0] - x;
+            d[1] = q[1] - y;
+        });
+
+    return field;
+}
+
+auto rt::ApproximateDeformationField(
+    const Transform::Pointer& transform,
+    const cv::Size& s,
+    double tolerance,
+    int spacing,
+    FieldApproximation* report) -> DeformationField::Pointer
+{
+    if (not transform) {
+        throw std::invalid_argument("transform is null");
+    }
+    if (spacing < 1) {
+        throw std::invalid_argument("lattice spacing must be positive");
+    }
+
+    // Use the same pixels to measure every lattice spacing
+    auto samples = ErrorSamples(s);
+
+    FieldApproximation info;
+    info.samples = static_cast<int>(samples.size());
+    DeformationField::Pointer field;
+    for (; spacing > 1; spacing /= 2) {
+        if (not field) {
+            field = NewField(s);
+        }
+        InterpolateLattice(transform, spacing, field);
+        info.spacing = spacing;
+        info.maxError = MaxFieldError(transform, field, samples);
+        if (info.maxError <= tolerance) {
+            break;
+        }
     }
-}
\ No newline at end of file
+
+    // Lattice spacing of 1 is exact evaluation
+    if (spacing <= 1) {
+        field = ComputeDeformationField(transform, s);
+        info.spacing = 1;
+        info.maxError = 0;
+    }
+
+    if (report != nullptr) {
+        *report = info;
+    }
+    return field;
+}
+
+auto rt::ApproximateTransform(
+    const Transform::Pointer& transform,
+    const cv::Size& s,
+    double tolerance,
+    int spacing,
+    FieldApproximation* report) -> Transform::Pointer
+{
+    if (not transform) {
+        throw std::invalid_argument("transform is null");
+    }
+    if (spacing < 1) {
+        throw std::invalid_argument("lattice spacing must be positive");
+    }
+
+    // Use the same pixels to measure every lattice spacing
+    auto samples = ErrorSamples(s);
+
+    FieldApproximation info;
+    info.samples = static_cast<int>(samples.size());
+    Transform::Pointer result;
+    for (; spacing > 1; spacing /= 2) {
+        result = LatticeTransform(transform, s, spacing);
+        info.spacing = spacing;
+        info.maxError = MaxTransformError(transform, result, samples);
+        if (info.maxError <= tolerance) {
+            break;
+        }
+    }
+
+    // Lattice spacing of 1 is exact evaluation
+    if (spacing <= 1) {
+        result = transform;
+        info.spacing = 1;
+        info.maxError = 0;
+    }
+
+    if (report != nullptr) {
+        *report = info;
+    }
+    return result;
+}
+
+auto rt::ParseInterpolation(const std::string& name) -> Interpolation
+{
+    if (name == "nearest") {
+        return Interpolation::Nearest;
+    } else if (name == "linear") {
+        return Interpolation::Linear;
+    } else if (name == "bspline") {
+        return Interpolation::BSpline;
+    } else if (name == "sinc") {
+        return Interpolation::WindowedSinc;
+    }
+    throw std::invalid_argument("unknown interpolation: " + name);
+}
+
+auto rt::ImageTransformResampler(
+    const cv::Mat& m,
+    const cv::Size& s,
+    const Transform::Pointer& transform,
+    Interpolation interpolation) -> cv::Mat
+{
+    if (not transform) {
+        throw std::invalid_argument("transform is null");
+    }
+
+    // Affine transforms don't need per-pixel evaluation
+    auto fits = CanRemap(m, s, interpolation);
+    if (fits and interpolation != Interpolation::BSpline) {
+        if (auto affine = AffineMatrix(transform)) {
+            return WarpAffine(m, *affine, s, interpolation);
+        }
+    }
+
+    // B-spline interpolation is always evaluated from a map. The map is
+    // only used once, so it is evaluated directly rather than from a field.
+    if (interpolation == Interpolation::BSpline or fits) {
+        auto map = TransformMap(transform, s.width, 0, s.height);
+        return ResampleFromMap(m, map, interpolation);
+    }
+    return ResampleWithTransform(m, {{0, 0}, s}, transform, interpolation);
+}
+
+auto rt::ImageTransformResampler(
+    const cv::Mat& m,
+    const DeformationField::Pointer& field,
+    Interpolation interpolation) -> cv::Mat
+{
+    if (not field) {
+        throw std::invalid_argument("deformation field is null");
+    }
+
+    auto s = FieldSize(field);
+    if (interpolation == Interpolation::BSpline or
+        CanRemap(m, s, interpolation)) {
+        return ResampleFromMap(m, FieldToMap(field), interpolation);
+    }
+
+    // Not supported by cv::remap: let ITK interpolate the field instead
+    using FieldTransform = itk::DisplacementFieldTransform<double, 2>;
+    auto transform = FieldTransform::New();
+    transform->SetDisplacementField(field);
+    return ResampleWithTransform(
+        m, {{0, 0}, s}, transform.GetPointer(), interpolation);
+}
+
+auto rt::ImageTransformResampler(
+    const std::vector<cv::Mat>& images,
+    const DeformationField::Pointer& field,
+    Interpolation interpolation) -> std::vector<cv::Mat>
+{
+    if (not field) {
+        throw std::invalid_argument("deformation field is null");
+    }
+
+    // Convert the field to a coordinate map once for the whole batch, then
+    // choose map or field per image
+    auto s = FieldSize(field);
+    auto remap = [&](const cv::Mat& m) {
+        return interpolation == Interpolation::BSpline or
+               CanRemap(m, s, interpolation);
+    };
+    cv::Mat map;
+    if (std::any_of(images.begin(), images.end(), remap)) {
+        map = FieldToMap(field);
+    }
+
+    std::vector<cv::Mat> results(images.size());
+    auto count = static_cast<int>(images.size());
+    cv::parallel_for_(cv::Range(0, count), [&](const cv::Range& r) {
+        for (auto i = r.start; i < r.end; i++) {
+            if (remap(images[i])) {
+                results[i] = ResampleFromMap(images[i], map, interpolation);
+            } else {
+                results[i] =
+                    ImageTransformResampler(images[i], field, interpolation);
+            }
+        }
+    });
+    return results;
+}
+
+void rt::ImageTransformResampler(
+    const cv::Mat& m,
+    const cv::Size& s,
+    const Transform::Pointer& transform,
+    const ResampledBandCallback& callback,
+    Interpolation interpolation,
+    int bandRows)
+{
+    if (not transform) {
+        throw std::invalid_argument("transform is null");
+    }
+    if (bandRows < 1) {
+        throw std::invalid_argument("band rows must be positive");
+    }
+
+    // Moving image state shared by every band
+    cv::Size bandSize{s.width, std::min(bandRows, s.height)};
+    auto useMap = interpolation == Interpolation::BSpline or
+                  CanRemap(m, bandSize, interpolation);
+    cv::Mat coeffs;
+    if (interpolation == Interpolation::BSpline) {
+        coeffs = BSplineCoefficients(m);
+    }
+    std::optional<cv::Matx23d> affine;
+    if (useMap and interpolation != Interpolation::BSpline) {
+        affine = AffineMatrix(transform);
+    }
+
+    auto resampleBand = [&](int y0, int rows) {
+        if (affine) {
+            // Shift the matrix so that output row y0 becomes row 0
+            auto a = *affine;
+            a(0, 2) += a(0, 1) * y0;
+            a(1, 2) += a(1, 1) * y0;
+            return WarpAffine(m, a, {s.width, rows}, interpolation);
+        }
+        if (not useMap) {
+            cv::Rect roi{0, y0, s.width, rows};
+            return ResampleWithTransform(m, roi, transform, interpolation);
+        }
+        auto map = TransformMap(transform, s.width, y0, rows);
+        if (interpolation == Interpolation::BSpline) {
+            return ResampleBSpline(m, coeffs, map);
+        }
+        return RemapImage(m, map, interpolation);
+    };
+
+    // Hand each band to the callback on a separate thread so that consuming
+    // one band overlaps with resampling the next
+    std::future<void> pending;
+    for (int y0 = 0; y0 < s.height; y0 += bandRows) {
+        auto band = resampleBand(y0, std::min(bandRows, s.height - y0));
+        if (pending.valid()) {
+            pending.get();
+        }
+        pending = std::async(std::launch::async, [&callback, band, y0]() {
+            callback(y0, band);
+        });
+    }
+    if (pending.valid()) {
+        pending.get();
+    }
+}
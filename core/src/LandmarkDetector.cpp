@@ -1,36 +1,213 @@
 #include "rt/LandmarkDetector.hpp"
 
 #include <algorithm>
+#include <array>
+#include <cstdlib>
 #include <exception>
+#include <random>
 
+#include <itkAffineTransform.h>
 #include <opencv2/calib3d.hpp>
 #include <opencv2/features2d.hpp>
 #include <opencv2/imgproc.hpp>
 
+#include "rt/io/FeatureIO.hpp"
+#include "rt/util/Hash.hpp"
 #include "rt/util/ImageConversion.hpp"
 
 using namespace rt;
+namespace fs = rt::filesystem;
 
 void LandmarkDetector::setFixedImage(const cv::Mat& img) { fixedImg_ = img; }
 void LandmarkDetector::setFixedMask(const cv::Mat& img) { fixedMask_ = img; }
 void LandmarkDetector::setMovingImage(const cv::Mat& img) { movingImg_ = img; }
 void LandmarkDetector::setMovingMask(const cv::Mat& img) { movingMask_ = img; }
+void LandmarkDetector::setDetector(Detector d) { detector_ = d; }
 void LandmarkDetector::setMatchRatio(float r) { nnMatchRatio_ = r; }
 void LandmarkDetector::setMaxImageDim(int s) { maxImageDim_ = s; }
+void LandmarkDetector::setTileSize(int s) { tileSize_ = s; }
+void LandmarkDetector::setTileOverlap(int s) { tileOverlap_ = s; }
+void LandmarkDetector::setMaxFeaturesPerTile(int n) { maxTileFeatures_ = n; }
+void LandmarkDetector::setFeatureCacheDir(const fs::path& dir)
+{
+    cacheDir_ = dir;
+}
 
 namespace
 {
 auto NeedsResize(const cv::Mat& img, int dimLimit, float& scale) -> bool
 {
+    // Non-positive limits disable resizing
     auto maxDim = std::max(img.rows, img.cols);
-    auto res = maxDim > dimLimit;
+    auto res = dimLimit > 0 and maxDim > dimLimit;
     if (res) {
         scale = static_cast<float>(dimLimit) / static_cast<float>(maxDim);
     }
     return res;
 }
+
+// Region of an image searched for features by one task. Features are
+// detected in roi, which extends core by the tile overlap, and are kept only
+// if they fall inside core.
+struct DetectionTile {
+    std::size_t image{0};
+    cv::Rect core;
+    cv::Rect roi;
+};
+
+// Split an image into detection tiles
+auto MakeTiles(std::size_t image, const cv::Size& size, int tile, int overlap)
+    -> std::vector<DetectionTile>
+{
+    cv::Rect bounds{{0, 0}, size};
+    if (tile <= 0) {
+        return {{image, bounds, bounds}};
+    }
+
+    std::vector<DetectionTile> tiles;
+    overlap = std::max(overlap, 0);
+    for (int y = 0; y < size.height; y += tile) {
+        for (int x = 0; x < size.width; x += tile) {
+            auto core = cv::Rect{x, y, tile, tile} & bounds;
+            cv::Rect roi{
+                core.x - overlap, core.y - overlap, core.width + 2 * overlap,
+                core.height + 2 * overlap};
+            tiles.push_back({image, core, roi & bounds});
+        }
+    }
+    return tiles;
+}
+
+// Name of a detector, as used in feature cache keys
+auto DetectorName(LandmarkDetector::Detector d) -> std::string
+{
+    using Detector = LandmarkDetector::Detector;
+    switch (d) {
+        case Detector::SIFT:
+            return "sift";
+        case Detector::AKAZE:
+            return "akaze";
+        case Detector::ORB:
+            return "orb";
+        case Detector::BRISK:
+            return "brisk";
+    }
+    throw std::invalid_argument("unknown feature detector");
+}
+
+auto CreateDetector(LandmarkDetector::Detector d) -> cv::Ptr<cv::Feature2D>
+{
+    using Detector = LandmarkDetector::Detector;
+    switch (d) {
+        case Detector::SIFT:
+            return cv::SIFT::create();
+        case Detector::AKAZE:
+            return cv::AKAZE::create();
+        case Detector::ORB:
+            return cv::ORB::create();
+        case Detector::BRISK:
+            return cv::BRISK::create();
+    }
+    throw std::invalid_argument("unknown feature detector");
+}
+
+// SIFT's float descriptors use a KD-tree. The binary descriptors of the
+// other detectors use Hamming distance.
+auto CreateMatcher(LandmarkDetector::Detector d)
+    -> cv::Ptr<cv::DescriptorMatcher>
+{
+    if (d == LandmarkDetector::Detector::SIFT) {
+        return cv::DescriptorMatcher::create(
+            cv::DescriptorMatcher::FLANNBASED);
+    }
+    return cv::BFMatcher::create(cv::NORM_HAMMING);
+}
+
+// Detect the features which belong to one tile, in image coordinates. If
+// maxFeatures is positive, only that many of the strongest features are kept.
+auto DetectTile(
+    const cv::Mat& img,
+    const cv::Mat& mask,
+    const DetectionTile& t,
+    LandmarkDetector::Detector type,
+    int maxFeatures) -> ImageFeatures
+{
+    cv::Mat tileMask;
+    if (not mask.empty()) {
+        // Nothing can be detected in a fully masked tile
+        if (cv::countNonZero(mask(t.core)) == 0) {
+            return {};
+        }
+        tileMask = mask(t.roi);
+    }
+
+    std::vector<cv::KeyPoint> keys;
+    cv::Mat desc;
+    auto detector = ::CreateDetector(type);
+    detector->detectAndCompute(img(t.roi), tileMask, keys, desc);
+
+    // Features in the overlap belong to a neighboring tile. Each position
+    // is owned by exactly one tile, so the merged result has no duplicates.
+    std::vector<int> owned;
+    cv::Point2f offset(t.roi.tl());
+    cv::Rect2f core(t.core);
+    for (int i = 0; i < static_cast<int>(keys.size()); i++) {
+        keys[i].pt += offset;
+        if (core.contains(keys[i].pt)) {
+            owned.push_back(i);
+        }
+    }
+
+    // Keep the strongest responses
+    if (maxFeatures > 0 and static_cast<int>(owned.size()) > maxFeatures) {
+        auto stronger = [&keys](int a, int b) {
+            return keys[a].response > keys[b].response;
+        };
+        std::nth_element(
+            owned.begin(), owned.begin() + maxFeatures, owned.end(), stronger);
+        owned.resize(maxFeatures);
+        std::sort(owned.begin(), owned.end());
+    }
+
+    ImageFeatures f;
+    f.keyPoints.reserve(owned.size());
+    for (auto i : owned) {
+        f.keyPoints.push_back(keys[i]);
+        f.descriptors.push_back(desc.row(i));
+    }
+    return f;
+}
+
+// Name of the feature cache file for an image, its mask, and the parameters
+// which affect detection
+auto FeatureCacheName(
+    const cv::Mat& img, const cv::Mat& mask, const std::string& params)
+    -> std::string
+{
+    auto hash = HashCombine(HashImage(img), HashImage(mask));
+    hash = HashBytes(params.data(), params.size(), hash);
+    return HashToString(hash) + ".feat";
+}
+
+// Write a feature cache file. Writes to a temporary file first so that
+// concurrent processes never read a partial file.
+void WriteFeatureCache(const fs::path& path, const ImageFeatures& features)
+{
+    fs::create_directories(path.parent_path());
+    auto suffix = ".tmp" + std::to_string(std::random_device{}());
+    auto tmp = path;
+    tmp += suffix;
+    WriteFeatures(tmp, features);
+    fs::rename(tmp, path);
+}
 }  // namespace
 
+auto LandmarkDetector::DefaultFeatureCacheDir() -> fs::path
+{
+    const auto* dir = std::getenv("RT_FEATURE_CACHE");
+    return dir == nullptr ? fs::path{} : fs::path{dir};
+}
+
 // Compute the matches
 auto LandmarkDetector::compute() -> std::vector<rt::LandmarkPair>
 {
@@ -39,62 +216,142 @@ auto LandmarkDetector::compute() -> std::vector<rt::LandmarkPair>
         throw std::runtime_error("Missing image(s)");
     }
 
-    // Clear the output vector
+    // Clear the outputs
     output_.clear();
+    homography_.release();
+
+    // Fixed image is index 0, moving image is index 1
+    const std::array<const char*, 2> names{"fixed", "moving"};
+    std::array<cv::Mat, 2> imgs{fixedImg_, movingImg_};
+    std::array<cv::Mat, 2> masks{fixedMask_, movingMask_};
+    std::array<ImageFeatures, 2> features;
 
-    // Resize inputs
-    cv::Mat fixedImg = QuantizeImage(fixedImg_, CV_8U);
-    cv::Mat movingImg = QuantizeImage(movingImg_, CV_8U);
-    cv::Mat fixedMask = QuantizeImage(ColorConvertImage(fixedMask_), CV_8U);
-    cv::Mat movingMask = QuantizeImage(ColorConvertImage(movingMask_), CV_8U);
-    float fs{1.};
-    float ms{1.};
-    if (::NeedsResize(fixedImg, maxImageDim_, fs)) {
-        cv::resize(fixedImg, fixedImg, cv::Size(), fs, fs, cv::INTER_AREA);
-        std::cerr << "Resized fixed image: ";
-        std::cerr << fixedImg.cols << "x" << fixedImg.rows << std::endl;
-        if (not fixedMask.empty()) {
-            cv::resize(
-                fixedMask, fixedMask, cv::Size(), fs, fs, cv::INTER_AREA);
-        }
-    }
-    if (::NeedsResize(movingImg, maxImageDim_, ms)) {
-        cv::resize(movingImg, movingImg, cv::Size(), ms, ms, cv::INTER_AREA);
-        std::cerr << "Resized moving image: ";
-        std::cerr << movingImg.cols << "x" << movingImg.rows << std::endl;
-        if (not movingMask.empty()) {
-            cv::resize(
-                movingMask, movingMask, cv::Size(), ms, ms, cv::INTER_AREA);
-        }
-    }
-
-    // Detect key points and compute their descriptors
-    auto featureDetector = cv::SIFT::create();
-    std::vector<cv::KeyPoint> fixedKeys;
-    std::vector<cv::KeyPoint> movingKeys;
-    cv::Mat fixedDesc;
-    cv::Mat movingDesc;
-    featureDetector->detectAndCompute(
-        fixedImg, fixedMask, fixedKeys, fixedDesc);
-    featureDetector->detectAndCompute(
-        movingImg, movingMask, movingKeys, movingDesc);
+    // Load features detected by a previous run
+    std::array<bool, 2> cached{false, false};
+    std::array<fs::path, 2> cachePaths;
+    if (not cacheDir_.empty()) {
+        auto params = ::DetectorName(detector_) + ":" +
+                      std::to_string(maxImageDim_) + ":" +
+                      std::to_string(tileSize_) + ":" +
+                      std::to_string(tileOverlap_) + ":" +
+                      std::to_string(maxTileFeatures_);
+        for (std::size_t i = 0; i < imgs.size(); i++) {
+            auto name = ::FeatureCacheName(imgs[i], masks[i], params);
+            cachePaths[i] = cacheDir_ / name;
+            if (not fs::exists(cachePaths[i])) {
+                continue;
+            }
+            try {
+                features[i] = ReadFeatures(cachePaths[i]);
+                cached[i] = true;
+                std::cerr << "Loaded cached " << names[i] << " features: ";
+                std::cerr << cachePaths[i].string() << std::endl;
+            } catch (const std::exception& e) {
+                std::cerr << "Warning: Ignoring feature cache file: ";
+                std::cerr << e.what() << std::endl;
+            }
+        }
+    }
+
+    // Quantize and resize both inputs at the same time
+    cv::parallel_for_(cv::Range(0, 2), [&](const cv::Range& r) {
+        for (auto i = r.start; i < r.end; i++) {
+            if (cached[i]) {
+                continue;
+            }
+            auto& img = imgs[i];
+            auto& mask = masks[i];
+            img = QuantizeImage(img, CV_8U);
+            mask = QuantizeImage(ColorConvertImage(mask), CV_8U);
+            auto& s = features[i].scale;
+            if (::NeedsResize(img, maxImageDim_, s)) {
+                cv::resize(img, img, cv::Size(), s, s, cv::INTER_AREA);
+                if (not mask.empty()) {
+                    cv::resize(mask, mask, cv::Size(), s, s, cv::INTER_AREA);
+                }
+            }
+        }
+    });
+    for (std::size_t i = 0; i < imgs.size(); i++) {
+        if (not cached[i] and features[i].scale != 1.F) {
+            std::cerr << "Resized " << names[i] << " image: ";
+            std::cerr << imgs[i].cols << "x" << imgs[i].rows << std::endl;
+        }
+    }
+
+    // Detect key points and compute their descriptors. Tiles from both
+    // images share one parallel loop.
+    std::vector<DetectionTile> tiles;
+    for (std::size_t i = 0; i < imgs.size(); i++) {
+        if (cached[i]) {
+            continue;
+        }
+        auto t = ::MakeTiles(i, imgs[i].size(), tileSize_, tileOverlap_);
+        tiles.insert(tiles.end(), t.begin(), t.end());
+    }
+    std::vector<ImageFeatures> tileFeatures(tiles.size());
+    auto numTiles = static_cast<int>(tiles.size());
+    cv::parallel_for_(cv::Range(0, numTiles), [&](const cv::Range& r) {
+        for (auto i = r.start; i < r.end; i++) {
+            const auto& t = tiles[i];
+            tileFeatures[i] = ::DetectTile(
+                imgs[t.image], masks[t.image], t, detector_, maxTileFeatures_);
+        }
+    });
+
+    // Collect features in tile order so that results are deterministic
+    for (std::size_t i = 0; i < tiles.size(); i++) {
+        auto& dst = features[tiles[i].image];
+        const auto& src = tileFeatures[i];
+        dst.keyPoints.insert(
+            dst.keyPoints.end(), src.keyPoints.begin(), src.keyPoints.end());
+        dst.descriptors.push_back(src.descriptors);
+    }
+
+    // Save newly detected features. The cache only saves time, so failures
+    // are not fatal.
+    for (std::size_t i = 0; i < imgs.size(); i++) {
+        if (cacheDir_.empty() or cached[i]) {
+            continue;
+        }
+        try {
+            ::WriteFeatureCache(cachePaths[i], features[i]);
+        } catch (const std::exception& e) {
+            std::cerr << "Warning: Failed to write feature cache: ";
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
+    const auto& fixedKeys = features[0].keyPoints;
+    const auto& movingKeys = features[1].keyPoints;
+    const auto& fixedDesc = features[0].descriptors;
+    const auto& movingDesc = features[1].descriptors;
+
+    // Nothing to match
+    if (fixedDesc.empty() or movingDesc.empty()) {
+        std::cerr << "Warning: No features detected in ";
+        std::cerr << (fixedDesc.empty() ? "fixed" : "moving");
+        std::cerr << " image" << std::endl;
+        return output_;
+    }
 
     // Match keypoints
-    auto matcher =
-        cv::DescriptorMatcher::create(cv::DescriptorMatcher::FLANNBASED);
+    auto matcher = ::CreateMatcher(detector_);
     std::vector<std::vector<cv::DMatch>> matches;
     matcher->knnMatch(fixedDesc, movingDesc, matches, 2);
 
     // Filter matches
     std::vector<cv::DMatch> goodMatches;
     for (const auto& m : matches) {
+        if (m.size() < 2) {
+            continue;
+        }
         if (m[0].distance < nnMatchRatio_ * m[1].distance) {
             goodMatches.push_back(m[0]);
         }
     }
 
     // Use RANSAC to filter matches further
-    // TODO: It's a shame that we can't keep and use this homography...
     std::vector<cv::Point2f> fixed;
     std::vector<cv::Point2f> moving;
     cv::Mat mask;
@@ -102,12 +359,25 @@ auto LandmarkDetector::compute() -> std::vector<rt::LandmarkPair>
         fixed.push_back(fixedKeys[m.queryIdx].pt);
         moving.emplace_back(movingKeys[m.trainIdx].pt);
     }
-    cv::findHomography(moving, fixed, cv::RANSAC, 3., mask);
+    cv::Mat h = cv::findHomography(moving, fixed, cv::RANSAC, 3., mask);
+    if (h.empty()) {
+        throw std::runtime_error("Failed to match features between images");
+    }
+
+    // Keep the homography. It maps resized moving pixels to resized fixed
+    // pixels, so invert it and undo the resize on both sides.
+    auto fixedScale = 1.F / features[0].scale;
+    auto movingScale = 1.F / features[1].scale;
+    auto shrink = static_cast<double>(features[0].scale);
+    auto grow = static_cast<double>(movingScale);
+    cv::Matx33d shrinkFixed(shrink, 0, 0, 0, shrink, 0, 0, 0, 1);
+    cv::Matx33d growMoving(grow, 0, 0, 0, grow, 0, 0, 0, 1);
+    cv::Matx33d full = growMoving * cv::Matx33d(h).inv() * shrinkFixed;
+    homography_ = cv::Mat(full * (1. / full(2, 2)));
+    homographySize_ = fixedImg_.size();
 
     // Convert good matches to landmark pairs
     // query = fixed, train = moving
-    fs = 1.F / fs;
-    ms = 1.F / ms;
     for (int idx = 0; idx < static_cast<int>(goodMatches.size()); idx++) {
         // Get match
         const auto& m = goodMatches[idx];
@@ -119,8 +389,8 @@ auto LandmarkDetector::compute() -> std::vector<rt::LandmarkPair>
 
         // From fixed -> moving
         if (m.imgIdx == 0) {
-            auto fixPt = fixedKeys[m.queryIdx].pt * fs;
-            auto movPt = movingKeys[m.trainIdx].pt * ms;
+            auto fixPt = fixedKeys[m.queryIdx].pt * fixedScale;
+            auto movPt = movingKeys[m.trainIdx].pt * movingScale;
             output_.emplace_back(fixPt, movPt);
         }
 
@@ -164,6 +434,76 @@ auto LandmarkDetector::getMovingLandmarks() const -> LandmarkContainer
     return res;
 }
 
+auto LandmarkDetector::detector() const -> Detector { return detector_; }
+
+auto LandmarkDetector::getHomography() const -> cv::Mat
+{
+    return homography_.clone();
+}
+
+auto LandmarkDetector::getHomographyTransform() const -> Transform::Pointer
+{
+    if (homography_.empty()) {
+        throw std::runtime_error("Homography has not been computed");
+    }
+
+    // Sample the homography on a lattice covering the fixed image
+    constexpr int samples{5};
+    std::vector<cv::Point2d> src;
+    auto w = std::max(homographySize_.width - 1, 1);
+    auto h = std::max(homographySize_.height - 1, 1);
+    for (int y = 0; y < samples; y++) {
+        for (int x = 0; x < samples; x++) {
+            src.emplace_back(
+                static_cast<double>(x * w) / (samples - 1),
+                static_cast<double>(y * h) / (samples - 1));
+        }
+    }
+    std::vector<cv::Point2d> dst;
+    cv::perspectiveTransform(src, dst, homography_);
+
+    // Least squares fit: [x y 1] * A = [x' y']
+    auto n = static_cast<int>(src.size());
+    cv::Mat lhs(n, 3, CV_64F);
+    cv::Mat rhs(n, 2, CV_64F);
+    for (int i = 0; i < n; i++) {
+        lhs.at<double>(i, 0) = src[i].x;
+        lhs.at<double>(i, 1) = src[i].y;
+        lhs.at<double>(i, 2) = 1.;
+        rhs.at<double>(i, 0) = dst[i].x;
+        rhs.at<double>(i, 1) = dst[i].y;
+    }
+    cv::Mat a;
+    cv::solve(lhs, rhs, a, cv::DECOMP_SVD);
+
+    using AffineTransform = itk::AffineTransform<double, 2>;
+    AffineTransform::MatrixType matrix;
+    AffineTransform::OutputVectorType translation;
+    for (unsigned r = 0; r < 2; r++) {
+        matrix(r, 0) = a.at<double>(0, static_cast<int>(r));
+        matrix(r, 1) = a.at<double>(1, static_cast<int>(r));
+        translation[r] = a.at<double>(2, static_cast<int>(r));
+    }
+    auto tfm = AffineTransform::New();
+    tfm->SetMatrix(matrix);
+    tfm->SetTranslation(translation);
+    return tfm.GetPointer();
+}
+
 auto LandmarkDetector::matchRatio() const -> float { return nnMatchRatio_; }
 
 auto LandmarkDetector::maxImageDim() const -> int { return maxImageDim_; }
+
+auto LandmarkDetector::tileSize() const -> int { return tileSize_; }
+
+auto LandmarkDetector::tileOverlap() const -> int { return tileOverlap_; }
+
+auto LandmarkDetector::maxFeaturesPerTile() const -> int
+{
+    return maxTileFeatures_;
+}
+
+auto LandmarkDetector::featureCacheDir() const -> fs::path
+{
+    return cacheDir_;
+}
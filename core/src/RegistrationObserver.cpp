@@ -0,0 +1,74 @@
+#include "rt/RegistrationObserver.hpp"
+
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+using namespace rt;
+
+namespace
+{
+// Write a JSON number. Non-finite values are written as null.
+void WriteNumber(std::ostream& os, double v)
+{
+    if (std::isfinite(v)) {
+        os << v;
+    } else {
+        os << "null";
+    }
+}
+
+// Shared state for the JSON-lines observer
+struct JSONLinesSink {
+    std::mutex mutex;
+    std::ofstream file;
+};
+}  // namespace
+
+auto rt::ToJSONLine(const IterationInfo& info) -> std::string
+{
+    std::ostringstream ss;
+    ss << std::setprecision(std::numeric_limits<double>::max_digits10);
+    ss << R"({"stage":")" << info.stage << R"(")";
+    ss << R"(,"tile":)" << info.tile;
+    ss << R"(,"level":)" << info.level;
+    ss << R"(,"iteration":)" << info.iteration;
+    ss << R"(,"metric":)";
+    WriteNumber(ss, info.metric);
+    ss << R"(,"stepLength":)";
+    WriteNumber(ss, info.stepLength);
+    ss << R"(,"gradientNorm":)";
+    WriteNumber(ss, info.gradientNorm);
+    ss << R"(,"elapsed":)";
+    WriteNumber(ss, info.elapsed);
+    ss << R"(,"iterationTime":)";
+    WriteNumber(ss, info.iterationTime);
+    ss << R"(,"metricTime":)";
+    WriteNumber(ss, info.metricTime);
+    ss << R"(,"updateTime":)";
+    WriteNumber(ss, info.updateTime);
+    ss << "}";
+    return ss.str();
+}
+
+auto rt::MakeJSONLinesObserver(const filesystem::path& path)
+    -> IterationObserver
+{
+    auto sink = std::make_shared<JSONLinesSink>();
+    sink->file.open(path.string(), std::ios::out | std::ios::trunc);
+    if (not sink->file.is_open()) {
+        throw std::runtime_error("Failed to open file: " + path.string());
+    }
+
+    return [sink](const IterationInfo& info) {
+        auto line = ToJSONLine(info);
+        std::scoped_lock lock(sink->mutex);
+        sink->file << line << "\n";
+        sink->file.flush();
+    };
+}
@@ -1,5 +1,7 @@
 #include "rt/io/TIFFIO.hpp"
 
+#include <algorithm>
+#include <array>
 #include <cstring>
 
 #include <opencv2/imgproc.hpp>
@@ -103,12 +105,27 @@ auto io::ReadRawTIFF(const fs::path& path, int offset) -> cv::Mat
     return output;
 }
 
-// Write a TIFF to a file. This implementation heavily borrows from how OpenCV's
-// TIFFEncoder writes to the TIFF
+// Write a TIFF to a file
 void io::WriteTIFF(const fs::path& path, const cv::Mat& img)
+{
+    TIFFWriter writer(path, img.size(), img.type());
+    writer.writeRows(img);
+    writer.close();
+}
+
+// Open a TIFF for writing. This implementation heavily borrows from how
+// OpenCV's TIFFEncoder writes to the TIFF
+io::TIFFWriter::TIFFWriter(
+    const fs::path& path, const cv::Size& size, int type)
+    : size_{size}, type_{type}
 {
     // Safety checks
-    if (img.channels() < 1 or img.channels() > 4) {
+    if (size.empty()) {
+        throw std::invalid_argument("Image is empty");
+    }
+
+    auto channels = CV_MAT_CN(type);
+    if (channels < 1 or channels > 4) {
         throw std::runtime_error("Unsupported number of channels");
     }
 
@@ -119,15 +136,13 @@ void io::WriteTIFF(const fs::path& path, const cv::Mat& img)
     }
 
     // Image metadata
-    auto channels = img.channels();
-    auto width = static_cast<unsigned>(img.cols);
-    auto height = static_cast<unsigned>(img.rows);
-    auto rowsPerStrip = height;
+    auto width = static_cast<unsigned>(size.width);
+    auto height = static_cast<unsigned>(size.height);
 
     // Sample format
     int bitsPerSample{-1};
     int sampleFormat{-1};
-    switch (img.depth()) {
+    switch (CV_MAT_DEPTH(type)) {
         case CV_8U:
             sampleFormat = SAMPLEFORMAT_UINT;
             bitsPerSample = 8;
@@ -176,60 +191,108 @@ void io::WriteTIFF(const fs::path& path, const cv::Mat& img)
     }
 
     // Open the file
-    auto* out = lt::TIFFOpen(path.c_str(), "w");
-    if (out == nullptr) {
+    out_ = lt::TIFFOpen(path.c_str(), "w");
+    if (out_ == nullptr) {
         throw std::runtime_error("Failed to open file for writing");
     }
 
     // Encoding parameters
-    lt::TIFFSetField(out, TIFFTAG_IMAGEWIDTH, width);
-    lt::TIFFSetField(out, TIFFTAG_IMAGELENGTH, height);
-    lt::TIFFSetField(out, TIFFTAG_PHOTOMETRIC, photometric);
-    lt::TIFFSetField(out, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
-    lt::TIFFSetField(out, TIFFTAG_COMPRESSION, COMPRESSION_LZW);
-    lt::TIFFSetField(out, TIFFTAG_SAMPLEFORMAT, sampleFormat);
-    lt::TIFFSetField(out, TIFFTAG_BITSPERSAMPLE, bitsPerSample);
-    lt::TIFFSetField(out, TIFFTAG_SAMPLESPERPIXEL, channels);
-    lt::TIFFSetField(out, TIFFTAG_ROWSPERSTRIP, rowsPerStrip);
+    lt::TIFFSetField(out_, TIFFTAG_IMAGEWIDTH, width);
+    lt::TIFFSetField(out_, TIFFTAG_IMAGELENGTH, height);
+    lt::TIFFSetField(out_, TIFFTAG_PHOTOMETRIC, photometric);
+    lt::TIFFSetField(out_, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    lt::TIFFSetField(out_, TIFFTAG_COMPRESSION, COMPRESSION_LZW);
+    lt::TIFFSetField(out_, TIFFTAG_SAMPLEFORMAT, sampleFormat);
+    lt::TIFFSetField(out_, TIFFTAG_BITSPERSAMPLE, bitsPerSample);
+    lt::TIFFSetField(out_, TIFFTAG_SAMPLESPERPIXEL, channels);
 
     // Add alpha tag data
     // TODO: Let user decide associated/unassociated tag
     // See TIFF 6.0 spec, section 18
     if (channels == 2 or channels == 4) {
         std::array<uint16_t, 1> tag{EXTRASAMPLE_UNASSALPHA};
-        lt::TIFFSetField(out, TIFFTAG_EXTRASAMPLES, 1, tag.data());
+        lt::TIFFSetField(out_, TIFFTAG_EXTRASAMPLES, 1, tag.data());
     }
 
     // Metadata
     lt::TIFFSetField(
-        out, TIFFTAG_SOFTWARE, ProjectInfo::NameAndVersion().c_str());
+        out_, TIFFTAG_SOFTWARE, ProjectInfo::NameAndVersion().c_str());
 
     // Row buffer. OpenCV documentation mentions that TIFFWriteScanline
     // modifies its read buffer, so we can't use the cv::Mat directly
-    auto bufferSize = static_cast<size_t>(lt::TIFFScanlineSize(out));
-    std::vector<char> buffer(bufferSize + 32);
+    auto bufferSize = static_cast<size_t>(lt::TIFFScanlineSize(out_));
+    buffer_.resize(bufferSize + 32);
+
+    // Strips of roughly 1 MiB, so that each strip is compressed and flushed
+    // while later rows are still being produced
+    constexpr std::size_t STRIP_BYTES{1 << 20};
+    auto rowsPerStrip = std::max<std::size_t>(1, STRIP_BYTES / bufferSize);
+    rowsPerStrip = std::min<std::size_t>(rowsPerStrip, height);
+    lt::TIFFSetField(
+        out_, TIFFTAG_ROWSPERSTRIP, static_cast<uint32_t>(rowsPerStrip));
+}
+
+io::TIFFWriter::~TIFFWriter()
+{
+    if (out_ != nullptr) {
+        lt::TIFFClose(out_);
+    }
+}
+
+void io::TIFFWriter::writeRows(const cv::Mat& rows)
+{
+    if (out_ == nullptr) {
+        throw std::runtime_error("TIFF writer is closed");
+    }
+    if (rows.type() != type_ or rows.cols != size_.width) {
+        throw std::invalid_argument("Rows do not match the image");
+    }
+    if (row_ + rows.rows > size_.height) {
+        throw std::runtime_error("Too many rows for image");
+    }
 
     // Get working copy with converted channels if an RGB-type image
-    cv::Mat imgCopy;
-    if (img.channels() == 3) {
-        cv::cvtColor(img, imgCopy, cv::COLOR_BGR2RGB);
-    } else if (img.channels() == 4) {
-        cv::cvtColor(img, imgCopy, cv::COLOR_BGRA2RGBA);
+    cv::Mat rowsCopy;
+    if (rows.channels() == 3) {
+        cv::cvtColor(rows, rowsCopy, cv::COLOR_BGR2RGB);
+    } else if (rows.channels() == 4) {
+        cv::cvtColor(rows, rowsCopy, cv::COLOR_BGRA2RGBA);
     } else {
-        imgCopy = img;
+        rowsCopy = rows;
     }
 
     // For each row
-    for (unsigned row = 0; row < height; row++) {
-        std::memcpy(&buffer[0], imgCopy.ptr(static_cast<int>(row)), bufferSize);
-        auto result = lt::TIFFWriteScanline(out, &buffer[0], row, 0);
+    auto bufferSize = buffer_.size() - 32;
+    for (int r = 0; r < rowsCopy.rows; r++, row_++) {
+        std::memcpy(&buffer_[0], rowsCopy.ptr(r), bufferSize);
+        auto row = static_cast<uint32_t>(row_);
+        auto result = lt::TIFFWriteScanline(out_, &buffer_[0], row, 0);
         if (result == -1) {
-            lt::TIFFClose(out);
-            auto msg = "Failed to write row " + std::to_string(row);
+            lt::TIFFClose(out_);
+            out_ = nullptr;
+            auto msg = "Failed to write row " + std::to_string(row_);
             throw std::runtime_error(msg);
         }
     }
+}
+
+auto io::TIFFWriter::rowsWritten() const -> int
+{
+    return row_;
+}
+
+void io::TIFFWriter::close()
+{
+    if (out_ == nullptr) {
+        return;
+    }
 
     // Close the tiff
-    lt::TIFFClose(out);
-}
\ No newline at end of file
+    lt::TIFFClose(out_);
+    out_ = nullptr;
+    if (row_ != size_.height) {
+        auto msg = "Incomplete image: wrote " + std::to_string(row_) +
+                   " of " + std::to_string(size_.height) + " rows";
+        throw std::runtime_error(msg);
+    }
+}
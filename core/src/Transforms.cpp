@@ -1,6 +1,7 @@
 #include "rt/types/Transforms.hpp"
 
 #include <itkCompositeTransformIOHelper.h>
+#include <itkScaleTransform.h>
 #include <itkTransformFactory.h>
 #include <itkTransformFileReader.h>
 #include <itkTransformFileWriter.h>
@@ -34,4 +35,39 @@ auto rt::ReadTransform(const fs::path& path) -> Transform::Pointer
 
     return dynamic_cast<CompositeTransform*>(
         reader->GetTransformList()->begin()->GetPointer());
-}
\ No newline at end of file
+}
+
+auto rt::ScaleTransform(const Transform::Pointer& transform, double scale)
+    -> Transform::Pointer
+{
+    if (not transform) {
+        throw std::invalid_argument("transform is null");
+    }
+    if (scale <= 0) {
+        throw std::invalid_argument("scale must be positive");
+    }
+
+    // Scale about the corner of pixel (0, 0) rather than its center
+    using Scale = itk::ScaleTransform<double, 2>;
+    Scale::InputPointType center;
+    center.Fill(-0.5);
+    Scale::ScaleType factor;
+
+    auto toFull = Scale::New();
+    toFull->SetCenter(center);
+    factor.Fill(1. / scale);
+    toFull->SetScale(factor);
+
+    auto toScaled = Scale::New();
+    toScaled->SetCenter(center);
+    factor.Fill(scale);
+    toScaled->SetScale(factor);
+
+    // Composites apply their last transform first
+    auto result = CompositeTransform::New();
+    result->AddTransform(toScaled);
+    result->AddTransform(transform);
+    result->AddTransform(toFull);
+    result->FlattenTransformQueue();
+    return result.GetPointer();
+}
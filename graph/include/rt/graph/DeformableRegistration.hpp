@@ -2,6 +2,8 @@
 
 /** @file */
 
+#include <vector>
+
 #include <opencv2/core.hpp>
 #include <smgl/Node.hpp>
 #include <smgl/Ports.hpp>
@@ -29,14 +31,65 @@ public:
     smgl::InputPort<cv::Mat> fixedImage;
     /** @brief Moving image */
     smgl::InputPort<cv::Mat> movingImage;
+    /** @copydoc DeformableRegistration::setFixedMask(const cv::Mat&) */
+    smgl::InputPort<cv::Mat> fixedMask;
+    /** @copydoc DeformableRegistration::setMovingMask(const cv::Mat&) */
+    smgl::InputPort<cv::Mat> movingMask;
     /** @brief Mesh Fill Size */
     smgl::InputPort<unsigned> meshFillSize;
     /** @brief Gradient magnitude tolerance */
     smgl::InputPort<double> gradientTolerance;
+    /**
+     * @copydoc DeformableRegistration::setInitialTransform(const
+     * rt::Transform::Pointer&)
+     */
+    smgl::InputPort<Transform::Pointer> initialTransform;
     /** @brief Deformable iterations */
     smgl::InputPort<int> iterations;
+    /** @copydoc DeformableRegistration::setNumberOfLevels(size_t) */
+    smgl::InputPort<std::size_t> levels;
+    /**
+     * @copydoc DeformableRegistration::setShrinkFactors(const
+     * std::vector<unsigned>&)
+     */
+    smgl::InputPort<std::vector<unsigned>> shrinkFactors;
+    /**
+     * @copydoc DeformableRegistration::setIterationsPerLevel(const
+     * std::vector<size_t>&)
+     */
+    smgl::InputPort<std::vector<std::size_t>> levelIterations;
+    /** @copydoc DeformableRegistration::setSamplingStrategy(Sampling) */
+    smgl::InputPort<DeformableRegistration::Sampling> samplingStrategy;
+    /** @copydoc DeformableRegistration::setSamplingPercentage(double) */
+    smgl::InputPort<double> samplingPercentage;
+    /** @copydoc DeformableRegistration::setHistogramBins(size_t) */
+    smgl::InputPort<std::size_t> histogramBins;
+    /** @copydoc DeformableRegistration::setRandomSeed(int) */
+    smgl::InputPort<int> randomSeed;
+    /** @copydoc DeformableRegistration::setEngine(Engine) */
+    smgl::InputPort<DeformableRegistration::Engine> engine;
+    /** @copydoc DeformableRegistration::setNumberOfThreads(unsigned) */
+    smgl::InputPort<unsigned> numberOfThreads;
+    /** @copydoc DeformableRegistration::setTileSize(int) */
+    smgl::InputPort<int> tileSize;
+    /** @copydoc DeformableRegistration::setTileOverlap(int) */
+    smgl::InputPort<int> tileOverlap;
+    /** @copydoc DeformableRegistration::setTimeBudget(double) */
+    smgl::InputPort<double> timeBudget;
+    /**
+     * @copydoc DeformableRegistration::setCheckpointPath(const
+     * filesystem::path&)
+     */
+    smgl::InputPort<filesystem::path> checkpointPath;
+    /** @copydoc DeformableRegistration::setCheckpointInterval(double) */
+    smgl::InputPort<double> checkpointInterval;
     /** @copydoc DeformableRegistration::setReportMetrics(bool) */
     smgl::InputPort<bool> reportMetrics;
+    /**
+     * @copydoc DeformableRegistration::setIterationObserver(IterationObserver)
+     * @note Not serialized
+     */
+    smgl::InputPort<IterationObserver> iterationObserver;
     /**@}*/
 
     /** @name Output Ports */
@@ -35,12 +35,28 @@ public:
     smgl::InputPort<cv::Mat> movingImage{&movingImg_};
     /** @brief Moving image port */
     smgl::InputPort<cv::Mat> movingMask{&movingMask_};
+    /** @copydoc LandmarkDetector::setDetector(LandmarkDetector::Detector) */
+    smgl::InputPort<LandmarkDetector::Detector> featureDetector{
+        &detector_, &LandmarkDetector::setDetector};
     /** @copydoc LandmarkDetector::setMatchRatio(float) */
     smgl::InputPort<float> matchRatio{
         &detector_, &LandmarkDetector::setMatchRatio};
     /** @copydoc LandmarkDetector::setMaxImageDim(int) */
     smgl::InputPort<int> maxImageDim{
         &detector_, &LandmarkDetector::setMaxImageDim};
+    /** @copydoc LandmarkDetector::setTileSize(int) */
+    smgl::InputPort<int> tileSize{&detector_, &LandmarkDetector::setTileSize};
+    /** @copydoc LandmarkDetector::setTileOverlap(int) */
+    smgl::InputPort<int> tileOverlap{
+        &detector_, &LandmarkDetector::setTileOverlap};
+    /** @copydoc LandmarkDetector::setMaxFeaturesPerTile(int) */
+    smgl::InputPort<int> maxFeaturesPerTile{
+        &detector_, &LandmarkDetector::setMaxFeaturesPerTile};
+    /**
+     * @copydoc LandmarkDetector::setFeatureCacheDir(const filesystem::path&)
+     */
+    smgl::InputPort<filesystem::path> featureCacheDir{
+        &detector_, &LandmarkDetector::setFeatureCacheDir};
     /**@}*/
 
     /** @name Output Ports */
@@ -49,6 +65,8 @@ public:
     smgl::OutputPort<LandmarkContainer> fixedLandmarks{&fixedLdm_};
     /** @brief Moving landmarks port */
     smgl::OutputPort<LandmarkContainer> movingLandmarks{&movingLdm_};
+    /** @copydoc LandmarkDetector::getHomographyTransform() */
+    smgl::OutputPort<Transform::Pointer> transform{&tfm_};
     /**@}*/
 
 private:
@@ -66,6 +84,8 @@ private:
     LandmarkContainer fixedLdm_;
     /** Detected moving landmarks */
     LandmarkContainer movingLdm_;
+    /** Homography transform */
+    Transform::Pointer tfm_;
     /** Graph serialize */
     smgl::Metadata serialize_(
         bool useCache, const filesystem::path& cacheDir) override;
@@ -92,6 +112,11 @@ public:
     smgl::InputPort<LandmarkContainer> movingLandmarks;
     /** @copydoc AffineLandmarkRegistration::setReportMetrics(bool) */
     smgl::InputPort<bool> reportMetrics;
+    /**
+     * @copydoc AffineLandmarkRegistration::setIterationObserver(IterationObserver)
+     * @note Not serialized
+     */
+    smgl::InputPort<IterationObserver> iterationObserver;
     /**@}*/
 
     /** @name Output Ports */
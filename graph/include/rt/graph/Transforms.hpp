@@ -2,10 +2,14 @@
 
 /** @file */
 
+#include <vector>
+
 #include <opencv2/core.hpp>
 #include <smgl/Node.hpp>
 #include <smgl/Ports.hpp>
 
+#include "rt/ITKImageTypes.hpp"
+#include "rt/ImageTransformResampler.hpp"
 #include "rt/LandmarkRegistrationBase.hpp"
 #include "rt/filesystem.hpp"
 #include "rt/types/Transforms.hpp"
@@ -180,11 +184,76 @@ private:
         const smgl::Metadata& meta, const filesystem::path& cacheDir) override;
 };
 
+/**
+ * @brief Evaluate a transform over the fixed image geometry
+ *
+ * The resulting field can be shared by any number of ImageResampleNode
+ * instances which resample into the same fixed image space.
+ *
+ * @see ComputeDeformationField
+ */
+class DeformationFieldNode : public smgl::Node
+{
+public:
+    /** Default constructor */
+    DeformationFieldNode();
+
+    /** @name Input Ports */
+    /**@{*/
+    /** @brief Fixed image port */
+    smgl::InputPort<cv::Mat> fixedImage{&fixed_};
+    /** @brief Transform port */
+    smgl::InputPort<Transform::Pointer> transform{&tfm_};
+    /**
+     * @brief Approximation tolerance port
+     *
+     * If positive, the field is approximated from a coarse lattice to within
+     * this many pixels. Otherwise, the transform is evaluated exactly at
+     * every pixel.
+     *
+     * @see ApproximateDeformationField
+     */
+    smgl::InputPort<double> tolerance{&tolerance_};
+    /**
+     * @brief Save the field in the graph cache
+     *
+     * Fields are stored uncompressed with 16 bytes per pixel, so this is
+     * disabled by default.
+     */
+    smgl::InputPort<bool> cacheField{&cacheField_};
+    /**@}*/
+
+    /** @name Output Ports */
+    /**@{*/
+    /** @brief Deformation field port */
+    smgl::OutputPort<DeformationField::Pointer> field{&field_};
+    /**@}*/
+
+private:
+    /** Approximation tolerance */
+    double tolerance_{0};
+    /** Save the field in the graph cache */
+    bool cacheField_{false};
+    /** Fixed image */
+    cv::Mat fixed_;
+    /** Transform */
+    Transform::Pointer tfm_;
+    /** Deformation field */
+    DeformationField::Pointer field_;
+    /** Graph serialize */
+    smgl::Metadata serialize_(
+        bool useCache, const filesystem::path& cacheDir) override;
+    /** Graph deserialize */
+    void deserialize_(
+        const smgl::Metadata& meta, const filesystem::path& cacheDir) override;
+};
+
 /**
  * @brief Resample an image using a transform
  *
  * Creates a new image the same size as the provided fixed image, then uses
  * the provided transform to map the moving image into this new image space.
+ * If a deformation field is provided, it is used in place of the transform.
  *
  * @see ImageTransformResampler
  */
@@ -202,6 +271,8 @@ public:
     smgl::InputPort<cv::Mat> movingImage{&moving_};
     /** @brief Transform port */
     smgl::InputPort<Transform::Pointer> transform{&tfm_};
+    /** @brief Deformation field port */
+    smgl::InputPort<DeformationField::Pointer> deformationField{&field_};
     /**
      * @brief Force alpha channel port
      *
@@ -209,6 +280,8 @@ public:
      * moving image does not have one.
      */
     smgl::InputPort<bool> forceAlpha{&forceAlpha_};
+    /** @brief Interpolation kernel port */
+    smgl::InputPort<Interpolation> interpolation{&interp_};
     /**@}*/
 
     /** @name Output Ports */
@@ -220,12 +293,16 @@ public:
 private:
     /** Force alpha flag */
     bool forceAlpha_{false};
+    /** Interpolation kernel */
+    Interpolation interp_{Interpolation::Nearest};
     /** Fixed image */
     cv::Mat fixed_;
     /** Moving image */
     cv::Mat moving_;
     /** Transform */
     Transform::Pointer tfm_;
+    /** Deformation field */
+    DeformationField::Pointer field_;
     /** Resampled image */
     cv::Mat resampled_;
     /** Graph serialize */
@@ -236,5 +313,185 @@ private:
         const smgl::Metadata& meta, const filesystem::path& cacheDir) override;
 };
 
+/**
+ * @brief Resample a downscaled preview of an image using a transform
+ *
+ * Approximates an ImageResampleNode followed by a resize to scale, but is
+ * much faster. The moving image is first reduced by area
+ * averaging, then resampled through a copy of the transform which is scaled
+ * to match, so the full-resolution output is never computed.
+ *
+ * @see ScaleTransform
+ */
+class ImagePreviewNode : public smgl::Node
+{
+public:
+    /** Default constructor */
+    ImagePreviewNode();
+
+    /** @name Input Ports */
+    /**@{*/
+    /** @brief Fixed image port */
+    smgl::InputPort<cv::Mat> fixedImage{&fixed_};
+    /** @brief Moving image port */
+    smgl::InputPort<cv::Mat> movingImage{&moving_};
+    /** @brief Transform port */
+    smgl::InputPort<Transform::Pointer> transform{&tfm_};
+    /** @brief Preview scale port, in the range (0, 1] */
+    smgl::InputPort<double> scale{&scale_};
+    /** @copydoc ImageResampleNode::forceAlpha */
+    smgl::InputPort<bool> forceAlpha{&forceAlpha_};
+    /** @brief Interpolation kernel port */
+    smgl::InputPort<Interpolation> interpolation{&interp_};
+    /**@}*/
+
+    /** @name Output Ports */
+    /**@{*/
+    /** @brief Preview image port */
+    smgl::OutputPort<cv::Mat> previewImage{&preview_};
+    /**@}*/
+
+private:
+    /** Preview scale */
+    double scale_{0.5};
+    /** Force alpha flag */
+    bool forceAlpha_{false};
+    /** Interpolation kernel */
+    Interpolation interp_{Interpolation::Nearest};
+    /** Fixed image */
+    cv::Mat fixed_;
+    /** Moving image */
+    cv::Mat moving_;
+    /** Transform */
+    Transform::Pointer tfm_;
+    /** Preview image */
+    cv::Mat preview_;
+    /** Graph serialize */
+    smgl::Metadata serialize_(
+        bool useCache, const filesystem::path& cacheDir) override;
+    /** Graph deserialize */
+    void deserialize_(
+        const smgl::Metadata& meta, const filesystem::path& cacheDir) override;
+};
+
+/**
+ * @brief Resample a batch of images using one transform
+ *
+ * Like ImageResampleNode, but for many moving images which share the same
+ * transform, such as the bands of a multispectral capture. The transform is
+ * evaluated once as a deformation field, and the images are resampled in
+ * parallel. If a deformation field is provided, it is used in place of the
+ * transform.
+ *
+ * @see ImageTransformResampler
+ */
+class ImageBatchResampleNode : public smgl::Node
+{
+public:
+    /** Default constructor */
+    ImageBatchResampleNode();
+
+    /** @name Input Ports */
+    /**@{*/
+    /** @brief Fixed image port */
+    smgl::InputPort<cv::Mat> fixedImage{&fixed_};
+    /** @brief Moving images port */
+    smgl::InputPort<std::vector<cv::Mat>> movingImages{&moving_};
+    /** @brief Transform port */
+    smgl::InputPort<Transform::Pointer> transform{&tfm_};
+    /** @brief Deformation field port */
+    smgl::InputPort<DeformationField::Pointer> deformationField{&field_};
+    /** @copydoc ImageResampleNode::forceAlpha */
+    smgl::InputPort<bool> forceAlpha{&forceAlpha_};
+    /** @brief Interpolation kernel port */
+    smgl::InputPort<Interpolation> interpolation{&interp_};
+    /**@}*/
+
+    /** @name Output Ports */
+    /**@{*/
+    /** @brief Resampled images port */
+    smgl::OutputPort<std::vector<cv::Mat>> resampledImages{&resampled_};
+    /**@}*/
+
+private:
+    /** Force alpha flag */
+    bool forceAlpha_{false};
+    /** Interpolation kernel */
+    Interpolation interp_{Interpolation::Nearest};
+    /** Fixed image */
+    cv::Mat fixed_;
+    /** Moving images */
+    std::vector<cv::Mat> moving_;
+    /** Transform */
+    Transform::Pointer tfm_;
+    /** Deformation field */
+    DeformationField::Pointer field_;
+    /** Resampled images */
+    std::vector<cv::Mat> resampled_;
+    /** Graph serialize */
+    smgl::Metadata serialize_(
+        bool useCache, const filesystem::path& cacheDir) override;
+    /** Graph deserialize */
+    void deserialize_(
+        const smgl::Metadata& meta, const filesystem::path& cacheDir) override;
+};
+
+/**
+ * @brief Resample an image using a transform and stream it to a TIFF file
+ *
+ * Equivalent to an ImageResampleNode followed by an ImageWriteNode, but the
+ * output is resampled in bands of rows which are written as soon as they are
+ * complete. The full-resolution output is never held in memory.
+ *
+ * @see ImageTransformResampler
+ * @see io::TIFFWriter
+ */
+class ImageResampleWriteNode : public smgl::Node
+{
+public:
+    /** Default constructor */
+    ImageResampleWriteNode();
+
+    /** @name Input Ports */
+    /**@{*/
+    /** @brief Output file path port. Must be a TIFF file. */
+    smgl::InputPort<filesystem::path> path{&path_};
+    /** @brief Fixed image port */
+    smgl::InputPort<cv::Mat> fixedImage{&fixed_};
+    /** @brief Moving image port */
+    smgl::InputPort<cv::Mat> movingImage{&moving_};
+    /** @brief Transform port */
+    smgl::InputPort<Transform::Pointer> transform{&tfm_};
+    /** @copydoc ImageResampleNode::forceAlpha */
+    smgl::InputPort<bool> forceAlpha{&forceAlpha_};
+    /** @brief Interpolation kernel port */
+    smgl::InputPort<Interpolation> interpolation{&interp_};
+    /** @brief Number of rows resampled and written at a time */
+    smgl::InputPort<int> bandRows{&bandRows_};
+    /**@}*/
+
+private:
+    /** Output file path */
+    filesystem::path path_;
+    /** Force alpha flag */
+    bool forceAlpha_{false};
+    /** Interpolation kernel */
+    Interpolation interp_{Interpolation::Nearest};
+    /** Band height */
+    int bandRows_{256};
+    /** Fixed image */
+    cv::Mat fixed_;
+    /** Moving image */
+    cv::Mat moving_;
+    /** Transform */
+    Transform::Pointer tfm_;
+    /** Graph serialize */
+    smgl::Metadata serialize_(
+        bool useCache, const filesystem::path& cacheDir) override;
+    /** Graph deserialize */
+    void deserialize_(
+        const smgl::Metadata& meta, const filesystem::path& cacheDir) override;
+};
+
 }  // namespace graph
 }  // namespace rt
\ No newline at end of file
@@ -9,18 +9,54 @@ rtg::DeformableRegistrationNode::DeformableRegistrationNode()
     : Node{true}
     , fixedImage{&reg_, &DeformableRegistration::setFixedImage}
     , movingImage{&reg_, &DeformableRegistration::setMovingImage}
+    , fixedMask{&reg_, &DeformableRegistration::setFixedMask}
+    , movingMask{&reg_, &DeformableRegistration::setMovingMask}
     , meshFillSize{&reg_, &DeformableRegistration::setMeshFillSize}
     , gradientTolerance{&reg_, &DeformableRegistration::setGradientMagnitudeTolerance}
+    , initialTransform{&reg_, &DeformableRegistration::setInitialTransform}
     , iterations{&iters_}
+    , levels{&reg_, &DeformableRegistration::setNumberOfLevels}
+    , shrinkFactors{&reg_, &DeformableRegistration::setShrinkFactors}
+    , levelIterations{&reg_, &DeformableRegistration::setIterationsPerLevel}
+    , samplingStrategy{&reg_, &DeformableRegistration::setSamplingStrategy}
+    , samplingPercentage{&reg_, &DeformableRegistration::setSamplingPercentage}
+    , histogramBins{&reg_, &DeformableRegistration::setHistogramBins}
+    , randomSeed{&reg_, &DeformableRegistration::setRandomSeed}
+    , engine{&reg_, &DeformableRegistration::setEngine}
+    , numberOfThreads{&reg_, &DeformableRegistration::setNumberOfThreads}
+    , tileSize{&reg_, &DeformableRegistration::setTileSize}
+    , tileOverlap{&reg_, &DeformableRegistration::setTileOverlap}
+    , timeBudget{&reg_, &DeformableRegistration::setTimeBudget}
+    , checkpointPath{&reg_, &DeformableRegistration::setCheckpointPath}
+    , checkpointInterval{&reg_, &DeformableRegistration::setCheckpointInterval}
     , reportMetrics{&reg_, &DeformableRegistration::setReportMetrics}
+    , iterationObserver{&reg_, &DeformableRegistration::setIterationObserver}
     , transform{&tfm_}
 {
     registerInputPort("fixedImage", fixedImage);
     registerInputPort("movingImage", movingImage);
+    registerInputPort("fixedMask", fixedMask);
+    registerInputPort("movingMask", movingMask);
+    registerInputPort("initialTransform", initialTransform);
     registerInputPort("iterations", iterations);
     registerInputPort("meshFillSize", meshFillSize);
     registerInputPort("gradientTolerance", gradientTolerance);
+    registerInputPort("levels", levels);
+    registerInputPort("shrinkFactors", shrinkFactors);
+    registerInputPort("levelIterations", levelIterations);
+    registerInputPort("samplingStrategy", samplingStrategy);
+    registerInputPort("samplingPercentage", samplingPercentage);
+    registerInputPort("histogramBins", histogramBins);
+    registerInputPort("randomSeed", randomSeed);
+    registerInputPort("engine", engine);
+    registerInputPort("numberOfThreads", numberOfThreads);
+    registerInputPort("tileSize", tileSize);
+    registerInputPort("tileOverlap", tileOverlap);
+    registerInputPort("timeBudget", timeBudget);
+    registerInputPort("checkpointPath", checkpointPath);
+    registerInputPort("checkpointInterval", checkpointInterval);
     registerInputPort("reportMetrics", reportMetrics);
+    registerInputPort("iterationObserver", iterationObserver);
     registerOutputPort("transform", transform);
 
     compute = [=]() {
@@ -37,11 +73,30 @@ auto rtg::DeformableRegistrationNode::serialize_(
     m["iterations"] = iters_;
     m["meshFillSize"] = reg_.getMeshFillSize();
     m["gradientTolerance"] = reg_.getGradientMagnitudeTolerance();
+    m["levels"] = reg_.getNumberOfLevels();
+    m["shrinkFactors"] = reg_.getShrinkFactors();
+    m["levelIterations"] = reg_.getIterationsPerLevel();
+    m["samplingStrategy"] = static_cast<int>(reg_.getSamplingStrategy());
+    m["samplingPercentage"] = reg_.getSamplingPercentage();
+    m["histogramBins"] = reg_.getHistogramBins();
+    m["randomSeed"] = reg_.getRandomSeed();
+    m["engine"] = static_cast<int>(reg_.getEngine());
+    m["numberOfThreads"] = reg_.getNumberOfThreads();
+    m["tileSize"] = reg_.getTileSize();
+    m["tileOverlap"] = reg_.getTileOverlap();
+    m["timeBudget"] = reg_.getTimeBudget();
+    m["checkpointPath"] = reg_.getCheckpointPath().string();
+    m["checkpointInterval"] = reg_.getCheckpointInterval();
     m["reportMetrics"] = reg_.getReportMetrics();
     if (useCache and tfm_) {
         WriteTransform(cacheDir / "deformable.tfm", tfm_);
         m["transform"] = "deformable.tfm";
     }
+    auto initial = reg_.getInitialTransform();
+    if (useCache and initial) {
+        WriteTransform(cacheDir / "deformable_initial.tfm", initial);
+        m["initialTransform"] = "deformable_initial.tfm";
+    }
     return m;
 }
 
@@ -51,9 +106,41 @@ void rtg::DeformableRegistrationNode::deserialize_(
     iters_ = meta["iterations"].get<int>();
     reg_.setMeshFillSize(meta["meshFillSize"].get<unsigned>());
     reg_.setGradientMagnitudeTolerance(meta["gradientTolerance"].get<double>());
+    if (meta.contains("levels")) {
+        reg_.setNumberOfLevels(meta["levels"].get<std::size_t>());
+        reg_.setShrinkFactors(
+            meta["shrinkFactors"].get<std::vector<unsigned>>());
+        reg_.setIterationsPerLevel(
+            meta["levelIterations"].get<std::vector<std::size_t>>());
+    }
+    if (meta.contains("samplingStrategy")) {
+        reg_.setSamplingStrategy(static_cast<DeformableRegistration::Sampling>(
+            meta["samplingStrategy"].get<int>()));
+        reg_.setSamplingPercentage(meta["samplingPercentage"].get<double>());
+        reg_.setHistogramBins(meta["histogramBins"].get<std::size_t>());
+        reg_.setRandomSeed(meta["randomSeed"].get<int>());
+    }
+    if (meta.contains("engine")) {
+        reg_.setEngine(static_cast<DeformableRegistration::Engine>(
+            meta["engine"].get<int>()));
+        reg_.setNumberOfThreads(meta["numberOfThreads"].get<unsigned>());
+    }
+    if (meta.contains("tileSize")) {
+        reg_.setTileSize(meta["tileSize"].get<int>());
+        reg_.setTileOverlap(meta["tileOverlap"].get<int>());
+    }
+    if (meta.contains("timeBudget")) {
+        reg_.setTimeBudget(meta["timeBudget"].get<double>());
+        reg_.setCheckpointPath(meta["checkpointPath"].get<std::string>());
+        reg_.setCheckpointInterval(meta["checkpointInterval"].get<double>());
+    }
     reg_.setReportMetrics(meta["reportMetrics"].get<bool>());
     if (meta.contains("transform")) {
         auto file = meta["transform"].get<std::string>();
         tfm_ = ReadTransform(cacheDir / file);
     }
+    if (meta.contains("initialTransform")) {
+        auto file = meta["initialTransform"].get<std::string>();
+        reg_.setInitialTransform(ReadTransform(cacheDir / file));
+    }
 }
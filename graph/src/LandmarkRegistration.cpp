@@ -11,10 +11,16 @@ rtg::LandmarkDetectorNode::LandmarkDetectorNode() : Node{true}
     registerInputPort("fixedMask", fixedMask);
     registerInputPort("movingImage", movingImage);
     registerInputPort("movingMask", movingMask);
+    registerInputPort("featureDetector", featureDetector);
     registerInputPort("matchRatio", matchRatio);
     registerInputPort("maxImageDim", maxImageDim);
+    registerInputPort("tileSize", tileSize);
+    registerInputPort("tileOverlap", tileOverlap);
+    registerInputPort("maxFeaturesPerTile", maxFeaturesPerTile);
+    registerInputPort("featureCacheDir", featureCacheDir);
     registerOutputPort("fixedLandmarks", fixedLandmarks);
     registerOutputPort("movingLandmarks", movingLandmarks);
+    registerOutputPort("transform", transform);
     compute = [this]() {
         std::cout << "Detecting landmarks..." << std::endl;
         detector_.setFixedImage(fixedImg_);
@@ -24,6 +30,10 @@ rtg::LandmarkDetectorNode::LandmarkDetectorNode() : Node{true}
         detector_.compute();
         fixedLdm_ = detector_.getFixedLandmarks();
         movingLdm_ = detector_.getMovingLandmarks();
+        tfm_ = nullptr;
+        if (not detector_.getHomography().empty()) {
+            tfm_ = detector_.getHomographyTransform();
+        }
     };
 }
 
@@ -31,8 +41,13 @@ smgl::Metadata rtg::LandmarkDetectorNode::serialize_(
     bool useCache, const fs::path& cacheDir)
 {
     smgl::Metadata m{
+        {"featureDetector", static_cast<int>(detector_.detector())},
         {"matchRatio", detector_.matchRatio()},
-        {"maxImageDim", detector_.maxImageDim()}};
+        {"maxImageDim", detector_.maxImageDim()},
+        {"tileSize", detector_.tileSize()},
+        {"tileOverlap", detector_.tileOverlap()},
+        {"maxFeaturesPerTile", detector_.maxFeaturesPerTile()},
+        {"featureCacheDir", detector_.featureCacheDir().string()}};
     if (useCache) {
         LandmarkWriter writer;
         writer.setPath(cacheDir / "landmarks.ldm");
@@ -41,6 +56,10 @@ smgl::Metadata rtg::LandmarkDetectorNode::serialize_(
         writer.write();
         m["landmarks"] = "landmarks.ldm";
     }
+    if (useCache and tfm_) {
+        WriteTransform(cacheDir / "homography.tfm", tfm_);
+        m["transform"] = "homography.tfm";
+    }
 
     return m;
 }
@@ -48,8 +67,26 @@ smgl::Metadata rtg::LandmarkDetectorNode::serialize_(
 void rtg::LandmarkDetectorNode::deserialize_(
     const smgl::Metadata& meta, const fs::path& cacheDir)
 {
+    if (meta.contains("featureDetector")) {
+        detector_.setDetector(static_cast<LandmarkDetector::Detector>(
+            meta["featureDetector"].get<int>()));
+    }
     detector_.setMatchRatio(meta["matchRatio"].get<float>());
     detector_.setMaxImageDim(meta["maxImageDim"].get<int>());
+    if (meta.contains("tileSize")) {
+        detector_.setTileSize(meta["tileSize"].get<int>());
+    }
+    if (meta.contains("tileOverlap")) {
+        detector_.setTileOverlap(meta["tileOverlap"].get<int>());
+    }
+    if (meta.contains("maxFeaturesPerTile")) {
+        auto n = meta["maxFeaturesPerTile"].get<int>();
+        detector_.setMaxFeaturesPerTile(n);
+    }
+    if (meta.contains("featureCacheDir")) {
+        auto dir = meta["featureCacheDir"].get<std::string>();
+        detector_.setFeatureCacheDir(dir);
+    }
     if (meta.contains("landmarks")) {
         auto file = meta["landmarks"].get<std::string>();
         LandmarkReader reader;
@@ -58,6 +95,10 @@ void rtg::LandmarkDetectorNode::deserialize_(
         fixedLdm_ = reader.getFixedLandmarks();
         movingLdm_ = reader.getMovingLandmarks();
     }
+    if (meta.contains("transform")) {
+        auto file = meta["transform"].get<std::string>();
+        tfm_ = ReadTransform(cacheDir / file);
+    }
 }
 
 rtg::AffineLandmarkRegistrationNode::AffineLandmarkRegistrationNode()
@@ -65,11 +106,13 @@ rtg::AffineLandmarkRegistrationNode::AffineLandmarkRegistrationNode()
     , fixedLandmarks{&fixed_}
     , movingLandmarks{&moving_}
     , reportMetrics{&reg_, &AffineLandmarkRegistration::setReportMetrics}
+    , iterationObserver{&reg_, &AffineLandmarkRegistration::setIterationObserver}
     , transform{&tfm_}
 {
     registerInputPort("fixedLandmarks", fixedLandmarks);
     registerInputPort("movingLandmarks", movingLandmarks);
     registerInputPort("reportMetrics", reportMetrics);
+    registerInputPort("iterationObserver", iterationObserver);
     registerOutputPort("transform", transform);
 
     compute = [this]() {
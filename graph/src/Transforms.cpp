@@ -1,8 +1,14 @@
 #include "rt/graph/Transforms.hpp"
 
+#include <algorithm>
+
+#include <opencv2/imgproc.hpp>
+
 #include "rt/ImageTransformResampler.hpp"
+#include "rt/io/DeformationFieldIO.hpp"
 #include "rt/io/ImageIO.hpp"
 #include "rt/io/LandmarkIO.hpp"
+#include "rt/io/TIFFIO.hpp"
 #include "rt/io/UVMapIO.hpp"
 #include "rt/util/ImageConversion.hpp"
 
@@ -170,12 +176,63 @@ void rtg::TransformUVMapNode::deserialize_(
     }
 }
 
+rtg::DeformationFieldNode::DeformationFieldNode() : Node{true}
+{
+    registerInputPort("fixedImage", fixedImage);
+    registerInputPort("transform", transform);
+    registerInputPort("tolerance", tolerance);
+    registerInputPort("cacheField", cacheField);
+    registerOutputPort("field", field);
+
+    compute = [=]() {
+        std::cout << "Computing deformation field..." << std::endl;
+        if (tolerance_ <= 0) {
+            field_ = ComputeDeformationField(tfm_, fixed_.size());
+            return;
+        }
+        FieldApproximation info;
+        field_ = ApproximateDeformationField(
+            tfm_, fixed_.size(), tolerance_, 16, &info);
+        std::cout << "Approximated deformation field with a lattice spacing ";
+        std::cout << "of " << info.spacing << " px (max. error: ";
+        std::cout << info.maxError << " px)" << std::endl;
+    };
+}
+
+smgl::Metadata rtg::DeformationFieldNode::serialize_(
+    bool useCache, const fs::path& cacheDir)
+{
+    smgl::Metadata m{{"tolerance", tolerance_}, {"cacheField", cacheField_}};
+    if (useCache and cacheField_ and field_) {
+        WriteDeformationField(cacheDir / "field.dfm", field_);
+        m["field"] = "field.dfm";
+    }
+    return m;
+}
+
+void rtg::DeformationFieldNode::deserialize_(
+    const smgl::Metadata& meta, const fs::path& cacheDir)
+{
+    if (meta.contains("tolerance")) {
+        tolerance_ = meta["tolerance"].get<double>();
+    }
+    if (meta.contains("cacheField")) {
+        cacheField_ = meta["cacheField"].get<bool>();
+    }
+    if (meta.contains("field")) {
+        auto file = meta["field"].get<std::string>();
+        field_ = ReadDeformationField(cacheDir / file);
+    }
+}
+
 rtg::ImageResampleNode::ImageResampleNode() : Node{true}
 {
     registerInputPort("fixedImage", fixedImage);
     registerInputPort("movingImage", movingImage);
     registerInputPort("transform", transform);
+    registerInputPort("deformationField", deformationField);
     registerInputPort("forceAlpha", forceAlpha);
+    registerInputPort("interpolation", interpolation);
     registerOutputPort("resampledImage", resampledImage);
 
     compute = [=]() {
@@ -187,7 +244,12 @@ rtg::ImageResampleNode::ImageResampleNode() : Node{true}
             tmp = moving_;
         }
         std::cout << "Resampling image..." << std::endl;
-        resampled_ = ImageTransformResampler(tmp, fixed_.size(), tfm_);
+        if (field_) {
+            resampled_ = ImageTransformResampler(tmp, field_, interp_);
+        } else {
+            resampled_ =
+                ImageTransformResampler(tmp, fixed_.size(), tfm_, interp_);
+        }
     };
 }
 
@@ -210,3 +272,159 @@ void rt::graph::ImageResampleNode::deserialize_(
         resampled_ = ReadImage(cacheDir / file);
     }
 }
+
+rtg::ImagePreviewNode::ImagePreviewNode() : Node{true}
+{
+    registerInputPort("fixedImage", fixedImage);
+    registerInputPort("movingImage", movingImage);
+    registerInputPort("transform", transform);
+    registerInputPort("scale", scale);
+    registerInputPort("forceAlpha", forceAlpha);
+    registerInputPort("interpolation", interpolation);
+    registerOutputPort("previewImage", previewImage);
+
+    compute = [=]() {
+        if (scale_ <= 0 or scale_ > 1) {
+            throw std::invalid_argument("preview scale must be in (0, 1]");
+        }
+
+        // Reduce the moving image before converting it
+        cv::Mat tmp;
+        cv::resize(moving_, tmp, {}, scale_, scale_, cv::INTER_AREA);
+        auto cns = tmp.channels();
+        if (forceAlpha_ and (cns == 1 or cns == 3)) {
+            tmp = ColorConvertImage(tmp, cns + 1);
+        }
+
+        cv::Size size{
+            std::max(cvRound(fixed_.cols * scale_), 1),
+            std::max(cvRound(fixed_.rows * scale_), 1)};
+        std::cout << "Resampling preview at " << size << "..." << std::endl;
+        auto tfm = ScaleTransform(tfm_, scale_);
+        preview_ = ImageTransformResampler(tmp, size, tfm, interp_);
+    };
+}
+
+smgl::Metadata rtg::ImagePreviewNode::serialize_(
+    bool useCache, const fs::path& cacheDir)
+{
+    smgl::Metadata m{{"scale", scale_}};
+    if (useCache and not preview_.empty()) {
+        WriteImage(cacheDir / "preview.tif", preview_);
+        m["image"] = "preview.tif";
+    }
+    return m;
+}
+
+void rtg::ImagePreviewNode::deserialize_(
+    const smgl::Metadata& meta, const fs::path& cacheDir)
+{
+    if (meta.contains("scale")) {
+        scale_ = meta["scale"].get<double>();
+    }
+    if (meta.contains("image")) {
+        auto file = meta["image"].get<std::string>();
+        preview_ = ReadImage(cacheDir / file);
+    }
+}
+
+rtg::ImageBatchResampleNode::ImageBatchResampleNode() : Node{true}
+{
+    registerInputPort("fixedImage", fixedImage);
+    registerInputPort("movingImages", movingImages);
+    registerInputPort("transform", transform);
+    registerInputPort("deformationField", deformationField);
+    registerInputPort("forceAlpha", forceAlpha);
+    registerInputPort("interpolation", interpolation);
+    registerOutputPort("resampledImages", resampledImages);
+
+    compute = [=]() {
+        std::vector<cv::Mat> tmp;
+        tmp.reserve(moving_.size());
+        for (const auto& m : moving_) {
+            auto cns = m.channels();
+            if (forceAlpha_ and (cns == 1 or cns == 3)) {
+                tmp.push_back(ColorConvertImage(m, cns + 1));
+            } else {
+                tmp.push_back(m);
+            }
+        }
+
+        auto field = field_;
+        if (not field) {
+            std::cout << "Computing deformation field..." << std::endl;
+            field = ComputeDeformationField(tfm_, fixed_.size());
+        }
+        std::cout << "Resampling " << tmp.size() << " images..." << std::endl;
+        resampled_ = ImageTransformResampler(tmp, field, interp_);
+    };
+}
+
+smgl::Metadata rtg::ImageBatchResampleNode::serialize_(
+    bool useCache, const fs::path& cacheDir)
+{
+    smgl::Metadata m;
+    if (useCache and not resampled_.empty()) {
+        m["images"] = smgl::Metadata::array();
+        for (std::size_t i = 0; i < resampled_.size(); i++) {
+            auto file = "resampled_" + std::to_string(i) + ".tif";
+            WriteImage(cacheDir / file, resampled_[i]);
+            m["images"].push_back(file);
+        }
+    }
+    return m;
+}
+
+void rtg::ImageBatchResampleNode::deserialize_(
+    const smgl::Metadata& meta, const fs::path& cacheDir)
+{
+    if (meta.contains("images")) {
+        resampled_.clear();
+        for (const auto& file : meta["images"]) {
+            resampled_.push_back(ReadImage(cacheDir / file.get<std::string>()));
+        }
+    }
+}
+
+rtg::ImageResampleWriteNode::ImageResampleWriteNode()
+{
+    registerInputPort("path", path);
+    registerInputPort("fixedImage", fixedImage);
+    registerInputPort("movingImage", movingImage);
+    registerInputPort("transform", transform);
+    registerInputPort("forceAlpha", forceAlpha);
+    registerInputPort("interpolation", interpolation);
+    registerInputPort("bandRows", bandRows);
+
+    compute = [=]() {
+        cv::Mat tmp;
+        auto cns = moving_.channels();
+        if (forceAlpha_ and (cns == 1 or cns == 3)) {
+            tmp = ColorConvertImage(moving_, cns + 1);
+        } else {
+            tmp = moving_;
+        }
+
+        std::cout << "Resampling image..." << std::endl;
+        io::TIFFWriter writer(path_, fixed_.size(), tmp.type());
+        ImageTransformResampler(
+            tmp, fixed_.size(), tfm_,
+            [&writer](int, const cv::Mat& band) { writer.writeRows(band); },
+            interp_, bandRows_);
+        writer.close();
+    };
+}
+
+smgl::Metadata rtg::ImageResampleWriteNode::serialize_(bool, const fs::path&)
+{
+    return {{"path", path_.string()}, {"bandRows", bandRows_}};
+}
+
+void rtg::ImageResampleWriteNode::deserialize_(
+    const smgl::Metadata& meta, const fs::path&)
+{
+    path_ = meta["path"].get<std::string>();
+    if (meta.contains("bandRows")) {
+        bandRows_ = meta["bandRows"].get<int>();
+    }
+}
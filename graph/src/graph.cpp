@@ -30,6 +30,10 @@ static auto RegisterNodesImpl() -> bool
     // Transforms
     registered &= smgl::RegisterNode<
         ImageResampleNode,
+        ImageBatchResampleNode,
+        ImagePreviewNode,
+        ImageResampleWriteNode,
+        DeformationFieldNode,
         TransformLandmarksNode,
         WriteTransformNode,
         TransformUVMapNode>();
@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+
+#include <random>
+
+#include "rt/BSplineGridEvaluator.hpp"
+
+using namespace rt;
+
+using BSpline = BSplineGridEvaluator::Transform;
+
+static auto RandomBSpline() -> BSpline::Pointer
+{
+    // Transform domain covers only part of the test image, so that both
+    // sides of the valid region boundary are tested
+    BSpline::OriginType origin;
+    origin[0] = 10;
+    origin[1] = 5;
+    BSpline::PhysicalDimensionsType dims;
+    dims[0] = 40;
+    dims[1] = 35;
+    BSpline::MeshSizeType mesh;
+    mesh[0] = 5;
+    mesh[1] = 3;
+    BSpline::DirectionType direction;
+    direction.SetIdentity();
+
+    auto t = BSpline::New();
+    t->SetTransformDomainOrigin(origin);
+    t->SetTransformDomainPhysicalDimensions(dims);
+    t->SetTransformDomainMeshSize(mesh);
+    t->SetTransformDomainDirection(direction);
+
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<double> dist(-3., 3.);
+    BSpline::ParametersType params(t->GetNumberOfParameters());
+    for (unsigned i = 0; i < params.Size(); i++) {
+        params[i] = dist(gen);
+    }
+    t->SetParametersByValue(params);
+    return t;
+}
+
+TEST(BSplineGridEvaluator, MatchesTransformPoint)
+{
+    auto t = RandomBSpline();
+    ASSERT_TRUE(BSplineGridEvaluator::IsSupported(t));
+
+    constexpr int width{64};
+    BSplineGridEvaluator grid(t, width);
+    ASSERT_EQ(grid.width(), width);
+
+    std::vector<cv::Point2d> row(width);
+    BSpline::InputPointType p;
+    for (int y = 0; y < 48; y++) {
+        grid.evaluateRow(y, row.data());
+        p[1] = y;
+        for (int x = 0; x < width; x++) {
+            p[0] = x;
+            auto q = t->TransformPoint(p);
+            EXPECT_NEAR(row[x].x, q[0], 1e-9) << "(" << x << ", " << y << ")";
+            EXPECT_NEAR(row[x].y, q[1], 1e-9) << "(" << x << ", " << y << ")";
+        }
+    }
+}
+
+TEST(BSplineGridEvaluator, RejectsRotatedGrid)
+{
+    auto t = RandomBSpline();
+    BSpline::DirectionType direction;
+    direction(0, 0) = 0;
+    direction(0, 1) = -1;
+    direction(1, 0) = 1;
+    direction(1, 1) = 0;
+    t->SetTransformDomainDirection(direction);
+
+    EXPECT_FALSE(BSplineGridEvaluator::IsSupported(t));
+    EXPECT_THROW(BSplineGridEvaluator(t, 8), std::invalid_argument);
+}
@@ -0,0 +1,198 @@
+#include <gtest/gtest.h>
+
+#include <opencv2/imgproc.hpp>
+
+#include "rt/DeformableRegistration.hpp"
+#include "rt/filesystem.hpp"
+#include "rt/types/Transforms.hpp"
+
+using namespace rt;
+namespace fs = rt::filesystem;
+
+// Smooth blob centered at (cx, cy)
+static auto Blob(double cx, double cy) -> cv::Mat
+{
+    cv::Mat m(64, 64, CV_8UC1, cv::Scalar(0));
+    cv::circle(m, {static_cast<int>(cx), static_cast<int>(cy)}, 12, 255, -1);
+    cv::GaussianBlur(m, m, {0, 0}, 4);
+    return m;
+}
+
+static auto Registration() -> DeformableRegistration
+{
+    DeformableRegistration reg;
+    reg.setFixedImage(Blob(32, 32));
+    reg.setMovingImage(Blob(34, 31));
+    reg.setNumberOfLevels(1);
+    reg.setNumberOfIterations(50);
+    reg.setRandomSeed(3);
+    return reg;
+}
+
+TEST(DeformableRegistration, TimeBudgetStopsOptimizer)
+{
+    std::size_t iterations{0};
+    auto reg = Registration();
+    reg.setTimeBudget(1e-9);
+    reg.setIterationObserver([&](const IterationInfo&) { iterations++; });
+
+    DeformableRegistration::Transform::Pointer result;
+    EXPECT_NO_THROW(result = reg.compute());
+    ASSERT_NE(result.GetPointer(), nullptr);
+    EXPECT_EQ(iterations, 1U);
+}
+
+TEST(DeformableRegistration, WritesCheckpoint)
+{
+    fs::path path = "TestDeformableRegistration_Checkpoint.tfm";
+    fs::remove(path);
+
+    auto reg = Registration();
+    reg.setNumberOfIterations(5);
+    reg.setCheckpointPath(path);
+    reg.setCheckpointInterval(0);
+    auto result = reg.compute();
+    ASSERT_NE(result.GetPointer(), nullptr);
+
+    // The checkpoint is a complete transform and no temporary file remains
+    ASSERT_TRUE(fs::exists(path));
+    EXPECT_FALSE(fs::exists("TestDeformableRegistration_Checkpoint.tmp.tfm"));
+    Transform::Pointer checkpoint;
+    EXPECT_NO_THROW(checkpoint = ReadTransform(path));
+    ASSERT_NE(checkpoint.GetPointer(), nullptr);
+    EXPECT_EQ(
+        checkpoint->GetNumberOfParameters(), result->GetNumberOfParameters());
+}
+
+TEST(DeformableRegistration, InitialTransformMustBeUnambiguous)
+{
+    auto bspline = [] {
+        auto t = DeformableRegistration::Transform::New();
+        t->SetIdentity();
+        return t;
+    };
+
+    auto one = CompositeTransform::New();
+    one->AddTransform(bspline());
+    auto two = CompositeTransform::New();
+    two->AddTransform(bspline());
+    two->AddTransform(bspline());
+
+    DeformableRegistration reg;
+    EXPECT_NO_THROW(reg.setInitialTransform(one.GetPointer()));
+    EXPECT_THROW(
+        reg.setInitialTransform(two.GetPointer()), std::invalid_argument);
+}
+
+// Two smooth blobs side by side, one per 64px tile
+static auto TwoBlobs(double dx, double dy) -> cv::Mat
+{
+    cv::Mat m(64, 128, CV_8UC1, cv::Scalar(0));
+    for (auto cx : {32.0, 96.0}) {
+        cv::Point c{static_cast<int>(cx + dx), static_cast<int>(32 + dy)};
+        cv::circle(m, c, 12, 255, -1);
+    }
+    cv::GaussianBlur(m, m, {0, 0}, 4);
+    return m;
+}
+
+static auto Displacement(
+    const DeformableRegistration::Transform::Pointer& t, double x, double y)
+    -> cv::Vec2d
+{
+    DeformableRegistration::Transform::InputPointType p;
+    p[0] = x;
+    p[1] = y;
+    auto d = t->TransformPoint(p) - p;
+    return {d[0], d[1]};
+}
+
+TEST(DeformableRegistration, TiledMatchesUntiled)
+{
+    auto reg = Registration();
+    reg.setFixedImage(TwoBlobs(0, 0));
+    reg.setMovingImage(TwoBlobs(2, -1));
+    auto untiled = reg.compute();
+
+    reg.setTileSize(64);
+    reg.setTileOverlap(8);
+    auto tiled = reg.compute();
+    ASSERT_NE(tiled.GetPointer(), nullptr);
+
+    for (auto cx : {32.0, 96.0}) {
+        auto expected = Displacement(untiled, cx, 32);
+        auto result = Displacement(tiled, cx, 32);
+        EXPECT_LT(cv::norm(result - expected), 1.0);
+    }
+}
+
+TEST(DeformableRegistration, UnregisteredTilesKeepInitialTransform)
+{
+    // Constant displacement of 1.5px in x over the whole image
+    auto initial = DeformableRegistration::Transform::New();
+    DeformableRegistration::Transform::PhysicalDimensionsType dims;
+    dims[0] = 127;
+    dims[1] = 63;
+    DeformableRegistration::Transform::MeshSizeType mesh;
+    mesh.Fill(4);
+    initial->SetTransformDomainPhysicalDimensions(dims);
+    initial->SetTransformDomainMeshSize(mesh);
+    auto params = initial->GetParameters();
+    auto half = params.GetSize() / 2;
+    for (unsigned i = 0; i < params.GetSize(); i++) {
+        params[i] = i < half ? 1.5 : 0.0;
+    }
+    initial->SetParametersByValue(params);
+
+    // Only the left tile has a fixed mask, so the right tile is not
+    // registered
+    cv::Mat mask(64, 128, CV_8UC1, cv::Scalar(0));
+    mask(cv::Rect{0, 0, 32, 64}) = 255;
+
+    auto reg = Registration();
+    reg.setFixedImage(TwoBlobs(0, 0));
+    reg.setMovingImage(TwoBlobs(0, 0));
+    reg.setFixedMask(mask);
+    reg.setInitialTransform(initial.GetPointer());
+    reg.setTileSize(64);
+    reg.setTileOverlap(8);
+    auto result = reg.compute();
+    ASSERT_NE(result.GetPointer(), nullptr);
+
+    auto d = Displacement(result, 100, 32);
+    EXPECT_NEAR(d[0], 1.5, 0.25);
+    EXPECT_NEAR(d[1], 0.0, 0.25);
+}
+
+TEST(DeformableRegistration, SeededRunsAreReproducible)
+{
+    using Sampling = DeformableRegistration::Sampling;
+    for (auto s : {Sampling::Random, Sampling::Stratified}) {
+        auto reg = Registration();
+        reg.setNumberOfIterations(10);
+        reg.setNumberOfThreads(1);
+        reg.setSamplingStrategy(s);
+        reg.setSamplingPercentage(0.25);
+        auto first = reg.compute()->GetParameters();
+        auto second = reg.compute()->GetParameters();
+        ASSERT_EQ(first.GetSize(), second.GetSize());
+        for (unsigned i = 0; i < first.GetSize(); i++) {
+            EXPECT_EQ(first[i], second[i]);
+        }
+    }
+}
+
+TEST(DeformableRegistration, EmptyMaskIntersectionThrows)
+{
+    auto reg = Registration();
+    cv::Mat mask(64, 64, CV_8UC1, cv::Scalar(0));
+    reg.setFixedMask(mask);
+    EXPECT_THROW(reg.compute(), std::invalid_argument);
+
+    // The only masked pixel falls between the regular sample positions
+    mask.at<uint8_t>(1, 1) = 255;
+    reg.setFixedMask(mask);
+    reg.setSamplingStrategy(DeformableRegistration::Sampling::Regular);
+    reg.setSamplingPercentage(0.25);
+    EXPECT_THROW(reg.compute(), std::runtime_error);
+}
@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "rt/io/FeatureIO.hpp"
+#include "rt/util/Hash.hpp"
+
+using namespace rt;
+
+static auto RandomFeatures(int num, int cols = 128, int type = CV_32F)
+    -> ImageFeatures
+{
+    cv::RNG rng(11);
+    ImageFeatures f;
+    for (int i = 0; i < num; i++) {
+        f.keyPoints.emplace_back(
+            cv::Point2f{rng.uniform(0.F, 100.F), rng.uniform(0.F, 100.F)},
+            rng.uniform(1.F, 10.F), rng.uniform(0.F, 360.F),
+            rng.uniform(0.F, 1.F), rng.uniform(0, 4), i);
+    }
+    f.descriptors.create(num, cols, type);
+    rng.fill(f.descriptors, cv::RNG::UNIFORM, 0, 255);
+    f.scale = 0.3F;
+    return f;
+}
+
+TEST(FeatureIO, RoundTrip)
+{
+    auto orig = RandomFeatures(50);
+
+    std::string path = "TestFeatureIO_RoundTrip.feat";
+    EXPECT_NO_THROW(WriteFeatures(path, orig));
+
+    ImageFeatures result;
+    EXPECT_NO_THROW(result = ReadFeatures(path));
+
+    EXPECT_FLOAT_EQ(result.scale, orig.scale);
+    ASSERT_EQ(result.keyPoints.size(), orig.keyPoints.size());
+    for (std::size_t i = 0; i < orig.keyPoints.size(); i++) {
+        const auto& a = orig.keyPoints[i];
+        const auto& b = result.keyPoints[i];
+        EXPECT_EQ(a.pt, b.pt);
+        EXPECT_EQ(a.size, b.size);
+        EXPECT_EQ(a.angle, b.angle);
+        EXPECT_EQ(a.response, b.response);
+        EXPECT_EQ(a.octave, b.octave);
+        EXPECT_EQ(a.class_id, b.class_id);
+    }
+    ASSERT_EQ(result.descriptors.type(), orig.descriptors.type());
+    ASSERT_EQ(result.descriptors.size(), orig.descriptors.size());
+    EXPECT_EQ(cv::norm(result.descriptors, orig.descriptors, cv::NORM_INF), 0);
+}
+
+TEST(FeatureIO, RoundTripBinary)
+{
+    auto orig = RandomFeatures(20, 32, CV_8U);
+
+    std::string path = "TestFeatureIO_RoundTripBinary.feat";
+    EXPECT_NO_THROW(WriteFeatures(path, orig));
+
+    ImageFeatures result;
+    EXPECT_NO_THROW(result = ReadFeatures(path));
+    ASSERT_EQ(result.keyPoints.size(), orig.keyPoints.size());
+    ASSERT_EQ(result.descriptors.type(), CV_8U);
+    ASSERT_EQ(result.descriptors.size(), orig.descriptors.size());
+    EXPECT_EQ(cv::norm(result.descriptors, orig.descriptors, cv::NORM_INF), 0);
+}
+
+TEST(FeatureIO, RoundTripEmpty)
+{
+    std::string path = "TestFeatureIO_RoundTripEmpty.feat";
+    EXPECT_NO_THROW(WriteFeatures(path, ImageFeatures{}));
+
+    ImageFeatures result;
+    EXPECT_NO_THROW(result = ReadFeatures(path));
+    EXPECT_TRUE(result.keyPoints.empty());
+    EXPECT_TRUE(result.descriptors.empty());
+}
+
+TEST(Hash, ImageHashIgnoresLayout)
+{
+    cv::Mat m(32, 48, CV_8UC3);
+    cv::randu(m, 0, 255);
+    cv::Mat view = m(cv::Rect{4, 4, 16, 16});
+    EXPECT_FALSE(view.isContinuous());
+    EXPECT_EQ(HashImage(view), HashImage(view.clone()));
+    EXPECT_NE(HashImage(m), HashImage(view));
+
+    // Same bytes in a different shape
+    EXPECT_NE(HashImage(m), HashImage(m.reshape(1)));
+}
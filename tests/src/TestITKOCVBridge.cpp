@@ -143,4 +143,56 @@ INSTANTIATE_TEST_SUITE_P(
         CV_16UC4,
         CV_32FC1,
         CV_32FC3,
-        CV_32FC4));
\ No newline at end of file
+        CV_32FC4));
+
+TEST(ITKOCVBridge, NonContinuousROI)
+{
+    cv::Mat img(100, 100, CV_8UC3);
+    cv::randu(img, cv::Scalar{0, 0, 0}, cv::Scalar{256, 256, 256});
+    cv::Mat roi = img(cv::Rect(10, 20, 50, 40));
+    ASSERT_FALSE(roi.isContinuous());
+
+    auto itkImage = CVMatToITKImage<Image8UC3>(roi);
+    for (int y = 0; y < roi.rows; y++) {
+        for (int x = 0; x < roi.cols; x++) {
+            Image8UC3::IndexType itkXY;
+            itkXY[0] = x;
+            itkXY[1] = y;
+            ComparePixel(itkImage->GetPixel(itkXY), roi.at<cv::Vec3b>(y, x));
+        }
+    }
+}
+
+TEST(ITKOCVBridge, ViewSharesBuffer)
+{
+    cv::Mat img(100, 100, CV_16UC1);
+    cv::randu(img, 0, 65536);
+
+    // Views share the same memory in both directions
+    auto itkImage = CVMatToITKImageView<Image16UC1>(img);
+    EXPECT_EQ(
+        reinterpret_cast<uint8_t*>(itkImage->GetBufferPointer()), img.data);
+    auto cvImage = ITKImageToCVMatView(itkImage);
+    EXPECT_EQ(cvImage.data, img.data);
+
+    // The view keeps the original buffer alive
+    auto expected = img.clone();
+    img.release();
+    for (int y = 0; y < expected.rows; y++) {
+        for (int x = 0; x < expected.cols; x++) {
+            Image16UC1::IndexType itkXY;
+            itkXY[0] = x;
+            itkXY[1] = y;
+            EXPECT_EQ(
+                itkImage->GetPixel(itkXY), expected.at<uint16_t>(y, x));
+        }
+    }
+}
+
+TEST(ITKOCVBridge, ViewRejectsIncompatibleMat)
+{
+    cv::Mat img(10, 10, CV_8UC1);
+    EXPECT_THROW(CVMatToITKImageView<Image16UC1>(img), std::invalid_argument);
+    cv::Mat roi = img(cv::Rect(0, 0, 5, 5));
+    EXPECT_THROW(CVMatToITKImageView<Image8UC1>(roi), std::invalid_argument);
+}
@@ -0,0 +1,326 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <tuple>
+
+#include <itkBSplineTransform.h>
+#include <itkTranslationTransform.h>
+#include <opencv2/core.hpp>
+
+#include "rt/ImageTransformResampler.hpp"
+
+using namespace rt;
+
+static auto Translation(double x, double y) -> Transform::Pointer
+{
+    using T = itk::TranslationTransform<double, 2>;
+    T::OutputVectorType v;
+    v[0] = x;
+    v[1] = y;
+    auto t = T::New();
+    t->Translate(v);
+    return t.GetPointer();
+}
+
+static auto Deformation(double magnitude) -> Transform::Pointer
+{
+    using T = itk::BSplineTransform<double, 2, 3>;
+    T::PhysicalDimensionsType dims;
+    dims[0] = 63;
+    dims[1] = 47;
+    T::MeshSizeType mesh;
+    mesh.Fill(4);
+
+    auto t = T::New();
+    t->SetTransformDomainPhysicalDimensions(dims);
+    t->SetTransformDomainMeshSize(mesh);
+
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<double> dist(-magnitude, magnitude);
+    T::ParametersType params(t->GetNumberOfParameters());
+    for (unsigned i = 0; i < params.Size(); i++) {
+        params[i] = dist(gen);
+    }
+    t->SetParametersByValue(params);
+    return t.GetPointer();
+}
+
+static auto RandomImage(int type) -> cv::Mat
+{
+    cv::Mat m(48, 64, type);
+    cv::randu(m, 0, 255);
+    return m;
+}
+
+class ImageTransformResampler : public testing::TestWithParam<int>
+{
+};
+
+class ResamplerInterpolation : public testing::TestWithParam<Interpolation>
+{
+};
+
+class ResamplerDepth
+    : public testing::TestWithParam<std::tuple<int, Interpolation>>
+{
+};
+
+TEST(DeformationField, StoresDisplacement)
+{
+    auto field = ComputeDeformationField(Translation(3, -2), {16, 8});
+    auto size = field->GetLargestPossibleRegion().GetSize();
+    EXPECT_EQ(size[0], 16U);
+    EXPECT_EQ(size[1], 8U);
+
+    const auto* d = field->GetBufferPointer();
+    for (std::size_t i = 0; i < size[0] * size[1]; i++) {
+        EXPECT_DOUBLE_EQ(d[i][0], 3);
+        EXPECT_DOUBLE_EQ(d[i][1], -2);
+    }
+}
+
+TEST(DeformationField, ApproximationOfAffineIsExact)
+{
+    cv::Size s{64, 48};
+    auto tfm = Translation(3.5, -2.25);
+    FieldApproximation info;
+    auto field = ApproximateDeformationField(tfm, s, 1e-6, 16, &info);
+    EXPECT_EQ(info.spacing, 16);
+    EXPECT_LT(info.maxError, 1e-6);
+
+    auto exact = ComputeDeformationField(tfm, s);
+    const auto* a = field->GetBufferPointer();
+    const auto* e = exact->GetBufferPointer();
+    for (int i = 0; i < s.area(); i++) {
+        EXPECT_NEAR(a[i][0], e[i][0], 1e-9);
+        EXPECT_NEAR(a[i][1], e[i][1], 1e-9);
+    }
+}
+
+TEST(DeformationField, ApproximationRefinesToTolerance)
+{
+    cv::Size s{64, 48};
+    auto tfm = Deformation(8);
+
+    FieldApproximation coarse;
+    ApproximateDeformationField(tfm, s, 1000, 16, &coarse);
+    EXPECT_EQ(coarse.spacing, 16);
+    EXPECT_GT(coarse.maxError, 0);
+
+    FieldApproximation fine;
+    auto tolerance = coarse.maxError / 4;
+    ApproximateDeformationField(tfm, s, tolerance, 16, &fine);
+    EXPECT_LT(fine.spacing, 16);
+    EXPECT_LE(fine.maxError, tolerance);
+    EXPECT_GT(fine.samples, 0);
+}
+
+TEST(DeformationField, ApproximationFallsBackToExact)
+{
+    cv::Size s{64, 48};
+    auto tfm = Deformation(8);
+    FieldApproximation info;
+    auto field = ApproximateDeformationField(tfm, s, 0, 16, &info);
+    EXPECT_EQ(info.spacing, 1);
+
+    auto exact = ComputeDeformationField(tfm, s);
+    const auto* a = field->GetBufferPointer();
+    const auto* e = exact->GetBufferPointer();
+    for (int i = 0; i < s.area(); i++) {
+        EXPECT_DOUBLE_EQ(a[i][0], e[i][0]);
+        EXPECT_DOUBLE_EQ(a[i][1], e[i][1]);
+    }
+}
+
+TEST(DeformationField, ApproximateTransformRefinesToTolerance)
+{
+    cv::Size s{64, 48};
+    auto tfm = Deformation(8);
+
+    FieldApproximation coarse;
+    auto approx = ApproximateTransform(tfm, s, 1000, 16, &coarse);
+    EXPECT_EQ(coarse.spacing, 16);
+    EXPECT_NE(approx.GetPointer(), tfm.GetPointer());
+
+    FieldApproximation fine;
+    auto tolerance = coarse.maxError / 4;
+    approx = ApproximateTransform(tfm, s, tolerance, 16, &fine);
+    EXPECT_LT(fine.spacing, 16);
+    EXPECT_LE(fine.maxError, tolerance);
+
+    // Lattice nodes are exact
+    auto n = fine.spacing;
+    for (const auto& px : {cv::Point{0, 0}, cv::Point{n, 2 * n}}) {
+        Transform::InputPointType p;
+        p[0] = px.x;
+        p[1] = px.y;
+        auto a = approx->TransformPoint(p);
+        auto e = tfm->TransformPoint(p);
+        EXPECT_NEAR(a[0], e[0], 1e-9);
+        EXPECT_NEAR(a[1], e[1], 1e-9);
+    }
+
+    // Exact evaluation uses the input transform
+    ApproximateTransform(tfm, s, 0, 16, &fine);
+    EXPECT_EQ(fine.spacing, 1);
+}
+
+TEST_P(ImageTransformResampler, Translation)
+{
+    auto m = RandomImage(GetParam());
+    auto result = rt::ImageTransformResampler(m, m.size(), Translation(3, 2));
+    ASSERT_EQ(result.size(), m.size());
+    ASSERT_EQ(result.type(), m.type());
+
+    // Pixels mapped from outside the moving image are zero
+    cv::Mat expected = cv::Mat::zeros(m.size(), m.type());
+    cv::Rect roi{0, 0, m.cols - 3, m.rows - 2};
+    m(roi + cv::Point{3, 2}).copyTo(expected(roi));
+    EXPECT_EQ(cv::norm(result, expected, cv::NORM_INF), 0);
+}
+
+TEST_P(ImageTransformResampler, FieldMatchesTransform)
+{
+    auto m = RandomImage(GetParam());
+    auto tfm = Translation(-5, 7);
+    auto field = ComputeDeformationField(tfm, {32, 24});
+
+    auto expected = rt::ImageTransformResampler(m, {32, 24}, tfm);
+    auto result = rt::ImageTransformResampler(m, field);
+    ASSERT_EQ(result.size(), expected.size());
+    ASSERT_EQ(result.type(), expected.type());
+    EXPECT_EQ(cv::norm(result, expected, cv::NORM_INF), 0);
+}
+
+TEST_P(ImageTransformResampler, BatchMatchesSingle)
+{
+    std::vector<cv::Mat> images{RandomImage(GetParam()),
+                                RandomImage(GetParam()),
+                                RandomImage(GetParam())};
+    auto field = ComputeDeformationField(Translation(-5, 7), {32, 24});
+
+    auto results = rt::ImageTransformResampler(images, field);
+    ASSERT_EQ(results.size(), images.size());
+    for (std::size_t i = 0; i < images.size(); i++) {
+        auto expected = rt::ImageTransformResampler(images[i], field);
+        ASSERT_EQ(results[i].size(), expected.size());
+        EXPECT_EQ(cv::norm(results[i], expected, cv::NORM_INF), 0);
+    }
+}
+
+TEST_P(ImageTransformResampler, AffineComposite)
+{
+    auto m = RandomImage(GetParam());
+    auto composite = CompositeTransform::New();
+    composite->AddTransform(Translation(1, 0));
+    composite->AddTransform(Translation(2, 2));
+
+    auto expected = rt::ImageTransformResampler(m, m.size(), Translation(3, 2));
+    auto result = rt::ImageTransformResampler(
+        m, m.size(), Transform::Pointer(composite.GetPointer()));
+    EXPECT_EQ(cv::norm(result, expected, cv::NORM_INF), 0);
+}
+
+TEST_P(ImageTransformResampler, BandsMatchFullImage)
+{
+    auto m = RandomImage(GetParam());
+    auto tfm = Translation(2.5, -1.5);
+    auto expected = rt::ImageTransformResampler(
+        m, m.size(), tfm, Interpolation::Linear);
+
+    // Use a band height which does not divide the image
+    cv::Mat result(m.size(), m.type());
+    int nextRow{0};
+    rt::ImageTransformResampler(
+        m, m.size(), tfm,
+        [&](int y, const cv::Mat& band) {
+            EXPECT_EQ(y, nextRow);
+            band.copyTo(result.rowRange(y, y + band.rows));
+            nextRow += band.rows;
+        },
+        Interpolation::Linear, 7);
+    EXPECT_EQ(nextRow, m.rows);
+    EXPECT_EQ(cv::norm(result, expected, cv::NORM_INF), 0);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Channels,
+    ImageTransformResampler,
+    testing::Values(
+        CV_8UC1,
+        CV_8UC2,
+        CV_8UC3,
+        CV_8UC4,
+        CV_16UC1,
+        CV_16UC4,
+        CV_32FC1,
+        CV_32FC4,
+        CV_8SC1,
+        CV_16SC1,
+        CV_16SC3,
+        CV_32SC1,
+        CV_32SC2,
+        CV_64FC1,
+        CV_64FC4));
+
+TEST_P(ResamplerInterpolation, IdentityPreservesImage)
+{
+    auto m = RandomImage(CV_8UC3);
+    auto result = rt::ImageTransformResampler(
+        m, m.size(), Translation(0, 0), GetParam());
+    ASSERT_EQ(result.type(), m.type());
+    EXPECT_LE(cv::norm(result, m, cv::NORM_INF), 1);
+}
+
+TEST_P(ResamplerInterpolation, SubpixelShiftPreservesConstant)
+{
+    cv::Mat m(48, 64, CV_16UC1, cv::Scalar::all(1000));
+    auto result = rt::ImageTransformResampler(
+        m, m.size(), Translation(0.5, 0.25), GetParam());
+
+    // Ignore the border, where kernels reach outside the image
+    cv::Rect interior{8, 8, m.cols - 16, m.rows - 16};
+    EXPECT_LE(cv::norm(result(interior), m(interior), cv::NORM_INF), 1);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Kernels,
+    ResamplerInterpolation,
+    testing::Values(
+        Interpolation::Nearest,
+        Interpolation::Linear,
+        Interpolation::BSpline,
+        Interpolation::WindowedSinc));
+
+TEST_P(ResamplerDepth, SubpixelShiftPreservesConstant)
+{
+    auto [depth, interpolation] = GetParam();
+    cv::Mat m(48, 64, CV_MAKETYPE(depth, 2), cv::Scalar::all(100));
+    auto result = rt::ImageTransformResampler(
+        m, m.size(), Translation(0.5, 0.25), interpolation);
+    ASSERT_EQ(result.type(), m.type());
+
+    cv::Rect interior{8, 8, m.cols - 16, m.rows - 16};
+    EXPECT_LE(cv::norm(result(interior), m(interior), cv::NORM_INF), 1);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Depths,
+    ResamplerDepth,
+    testing::Combine(
+        testing::Values(
+            CV_8U, CV_8S, CV_16U, CV_16S, CV_32S, CV_32F, CV_64F),
+        testing::Values(
+            Interpolation::Nearest,
+            Interpolation::Linear,
+            Interpolation::BSpline)));
+
+TEST(ResamplerBSpline, ManyChannels)
+{
+    cv::Mat m(48, 64, CV_16UC(6));
+    cv::randu(m, 0, 1000);
+    auto result = rt::ImageTransformResampler(
+        m, m.size(), Translation(0, 0), Interpolation::BSpline);
+    ASSERT_EQ(result.type(), m.type());
+    EXPECT_LE(cv::norm(result, m, cv::NORM_INF), 1);
+}
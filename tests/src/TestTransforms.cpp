@@ -0,0 +1,54 @@
+#include <gtest/gtest.h>
+
+#include <itkAffineTransform.h>
+#include <itkTranslationTransform.h>
+
+#include "rt/types/Transforms.hpp"
+
+using namespace rt;
+
+static auto Point(double x, double y) -> Transform::InputPointType
+{
+    Transform::InputPointType p;
+    p[0] = x;
+    p[1] = y;
+    return p;
+}
+
+TEST(ScaleTransform, ScalesTranslation)
+{
+    using T = itk::TranslationTransform<double, 2>;
+    T::OutputVectorType v;
+    v[0] = 2;
+    v[1] = 4;
+    auto t = T::New();
+    t->Translate(v);
+
+    auto scaled = ScaleTransform(t.GetPointer(), 0.5);
+    for (const auto& p : {Point(0, 0), Point(3, 7), Point(-1.5, 10.25)}) {
+        auto q = scaled->TransformPoint(p);
+        EXPECT_NEAR(q[0], p[0] + 1, 1e-9);
+        EXPECT_NEAR(q[1], p[1] + 2, 1e-9);
+    }
+}
+
+TEST(ScaleTransform, PreservesPixelCenters)
+{
+    // The center of pixel (0, 0) at quarter scale is full-resolution pixel
+    // 1.5. Doubling maps it to pixel 3, which is pixel 0.375 at quarter scale.
+    using T = itk::AffineTransform<double, 2>;
+    auto t = T::New();
+    t->Scale(2.);
+
+    auto scaled = ScaleTransform(t.GetPointer(), 0.25);
+    auto q = scaled->TransformPoint(Point(0, 0));
+    EXPECT_NEAR(q[0], 0.375, 1e-9);
+    EXPECT_NEAR(q[1], 0.375, 1e-9);
+}
+
+TEST(ScaleTransform, RejectsInvalidScale)
+{
+    auto t = itk::TranslationTransform<double, 2>::New();
+    EXPECT_THROW(ScaleTransform(t.GetPointer(), 0), std::invalid_argument);
+    EXPECT_THROW(ScaleTransform(nullptr, 0.5), std::invalid_argument);
+}